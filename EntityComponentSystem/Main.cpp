@@ -270,6 +270,344 @@ void WorldTest()
     world.Update();
 }
 
+void SystemSchedulingTest()
+{
+    struct A
+    {
+        A(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct B
+    {
+        B(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct C
+    {
+        C(int a) : Value(a) {}
+        int Value;
+    };
+
+    static std::atomic<int> running;
+    static std::atomic<bool> overlapped;
+
+    // Waits a bit for job of other system, jobs of systems without conflicts should be running at the same time
+    struct Overlap
+    {
+        static void Wait()
+        {
+            running++;
+            for (int i = 0; i < 100000 && running.load() < 2; ++i)
+                std::this_thread::yield();
+            if (running.load() >= 2)
+                overlapped = true;
+        }
+    };
+
+    class ASystem : public System
+    {
+    public:
+        using System::System;
+
+        virtual void OnCreate()
+        {
+            WritesComponent<A>();
+
+            auto archetype = Manager.CreateArchetype({ typeof(A), typeof(B), typeof(C) });
+            for (int i = 0; i < 100; ++i)
+            {
+                Entity entity = Manager.CreateEntity(archetype);
+                Manager.SetComponentData(entity, A(0));
+                Manager.SetComponentData(entity, B(0));
+                Manager.SetComponentData(entity, C(0));
+            }
+        }
+
+        virtual void OnUpdate()
+        {
+            // Bodies stay on main thread even with declared access, only their jobs run on workers
+            assert(GetWorkerIndex() == -1);
+            Entities().ForEach([](cwrite(A) a) { Overlap::Wait(); a.Value += 1; }).Schedule();
+        }
+    };
+
+    class BSystem : public System
+    {
+    public:
+        using System::System;
+
+        virtual void OnCreate()
+        {
+            WritesComponent<B>();
+        }
+
+        // Runs on main thread without waiting for job of ASystem
+        virtual void OnUpdate()
+        {
+            assert(GetWorkerIndex() == -1);
+            Entities().ForEach([](cwrite(B) b) { Overlap::Wait(); b.Value += 2; }).Run();
+        }
+    };
+
+    // Access is inferred, every update runs on main thread
+    class CSystem : public System
+    {
+    public:
+        using System::System;
+
+        virtual void OnUpdate()
+        {
+            Entities().ForEach([](cread(A) a, cread(B) b, cwrite(C) c) { c.Value = a.Value + b.Value; }).Run();
+        }
+    };
+
+    WorkerManager workerManager;
+    workerManager.Start(2);
+    {
+        World world(&workerManager);
+        world.GetOrCreateSystem<ASystem>();
+        world.GetOrCreateSystem<BSystem>();
+        world.GetOrCreateSystem<CSystem>();
+
+        for (int frame = 1; frame <= 4; ++frame)
+        {
+            running = 0;
+            world.Update();
+
+            Query query(&world.GetManager());
+            query.ForEach([=](cread(C) c) { assert(c.Value == frame * 3); }).Run();
+        }
+        assert(overlapped);
+    }
+
+    // Writer waits for every reader scheduled before it, not only for the last one
+    {
+        EntityManager manager;
+        Entity entity = manager.CreateEntity(manager.CreateArchetype({ typeof(A) }));
+        manager.SetComponentData(entity, A(0));
+
+        std::atomic<bool> slowReaderDone = false;
+        Query(&manager, &workerManager).ForEach([&](cread(A) a)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            assert(a.Value == 0);
+            slowReaderDone = true;
+        }).Schedule();
+        Query(&manager, &workerManager).ForEach([](cread(A) a) {}).Schedule();
+        auto writer = Query(&manager, &workerManager).ForEach([&](cwrite(A) a)
+        {
+            assert(slowReaderDone);
+            a.Value = 1;
+        }).Schedule();
+        workerManager.Complete(writer);
+        assert(manager.GetComponentData<A>(entity).Value == 1);
+    }
+    workerManager.Stop();
+}
+
+// Systems with inferred access stay on main thread, so producers can share command buffer system without locks
+void CommandBufferProducersTest()
+{
+    struct A
+    {
+        A(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct B
+    {
+        B(int a) : Value(a) {}
+        int Value;
+    };
+
+    static std::thread::id mainThread;
+    static std::atomic<int> offMainThread;
+
+    class IncrementSystem : public System
+    {
+    public:
+        using System::System;
+
+        virtual void OnCreate()
+        {
+            EcbSystem = &World->GetOrCreateSystem<EndSimulationCommandBufferSystem>();
+
+            auto archetype = Manager.CreateArchetype({ typeof(A) });
+            for (int i = 0; i < 64; ++i)
+            {
+                Entity entity = Manager.CreateEntity(archetype);
+                Manager.SetComponentData(entity, A(0));
+            }
+        }
+
+        virtual void OnUpdate()
+        {
+            if (std::this_thread::get_id() != mainThread)
+                offMainThread++;
+
+            auto ecb = EcbSystem->GetBuffer()->AsParallelWriter();
+            auto dependency = Entities().ForEach([=](Entity entity, cread(A) a)
+            {
+                ecb.SetComponentData(entity.Index, entity, A(a.Value + 1));
+            }).Schedule();
+            EcbSystem->AddProducer(dependency);
+        }
+
+        EndSimulationCommandBufferSystem* EcbSystem;
+    };
+
+    class SpawnSystem : public System
+    {
+    public:
+        using System::System;
+
+        virtual void OnCreate()
+        {
+            EcbSystem = &World->GetOrCreateSystem<EndSimulationCommandBufferSystem>();
+            Archetype = Manager.CreateArchetype({ typeof(B) });
+        }
+
+        virtual void OnUpdate()
+        {
+            if (std::this_thread::get_id() != mainThread)
+                offMainThread++;
+
+            auto ecb = EcbSystem->GetBuffer()->AsParallelWriter();
+            auto archetype = Archetype;
+            auto dependency = Entities().ForEach([=](Entity entity, cread(A) a)
+            {
+                Entity spawned = ecb.CreateEntity(entity.Index, archetype);
+                ecb.SetComponentData(entity.Index, spawned, B(a.Value));
+            }).Schedule();
+            EcbSystem->AddProducer(dependency);
+        }
+
+        EndSimulationCommandBufferSystem* EcbSystem;
+        EntityArchetype Archetype;
+    };
+
+    mainThread = std::this_thread::get_id();
+    offMainThread = 0;
+
+    WorkerManager workerManager;
+    workerManager.Start(4);
+    {
+        World world(&workerManager);
+        world.GetOrCreateSystem<IncrementSystem>();
+        world.GetOrCreateSystem<SpawnSystem>();
+
+        // Command buffer system updates first, so commands recorded in frame are played back in the next one
+        const int frameCount = 8;
+        for (int frame = 0; frame < frameCount; ++frame)
+            world.Update();
+
+        int count = 0;
+        Query(&world.GetManager()).ForEach([&](cread(A) a) { assert(a.Value == frameCount - 1); count++; }).Run();
+        assert(count == 64);
+
+        count = 0;
+        int sum = 0;
+        Query(&world.GetManager()).ForEach([&](cread(B) b) { sum += b.Value; count++; }).Run();
+        assert(count == 64 * (frameCount - 1));
+        assert(sum == 64 * (frameCount - 1) * (frameCount - 2) / 2);
+    }
+    workerManager.Stop();
+
+    assert(offMainThread == 0);
+}
+
+void SystemGroupTest()
+{
+    static std::vector<int> updates;
+
+    class Second : public System
+    {
+    public:
+        using System::System;
+        virtual void OnUpdate() { updates.push_back(2); }
+    };
+
+    class First : public System
+    {
+    public:
+        using System::System;
+        virtual void OnCreate() { UpdateBefore<Second>(); }
+        virtual void OnUpdate() { updates.push_back(1); }
+    };
+
+    class Third : public System
+    {
+    public:
+        using System::System;
+        virtual void OnCreate() { UpdateAfter<Second>(); }
+        virtual void OnUpdate() { updates.push_back(3); }
+    };
+
+    class SimulationGroup : public FixedStepSystemGroup
+    {
+    public:
+        using FixedStepSystemGroup::FixedStepSystemGroup;
+        virtual void OnCreate() { SetTimestep(0.25f); }
+    };
+
+    class Simulation : public System
+    {
+    public:
+        using System::System;
+        virtual void OnCreate() { UpdateInGroup<SimulationGroup>(); }
+        virtual void OnUpdate()
+        {
+            assert(GetDeltaTime() == 0.25f);
+            updates.push_back(4);
+        }
+    };
+
+    WorkerManager workerManager;
+    workerManager.Start(2);
+
+    for (int concurrent = 0; concurrent < 2; ++concurrent)
+    {
+        World world;
+        World concurrentWorld(&workerManager);
+        World& target = concurrent ? concurrentWorld : world;
+
+        auto& third = target.GetOrCreateSystem<Third>();
+        target.GetOrCreateSystem<First>();
+        target.GetOrCreateSystem<Second>();
+        target.GetOrCreateSystem<Simulation>();
+        assert(&target.GetOrCreateSystem<Third>() == &third);
+        assert(target.GetExistingSystem<SimulationGroup>() != nullptr);
+
+        // Two fixed steps
+        updates.clear();
+        target.Update(0.5f);
+        assert(updates == std::vector<int>({ 1, 2, 3, 4, 4 }));
+
+        // Step is accumulated across frames
+        updates.clear();
+        target.Update(0.125f);
+        assert(updates == std::vector<int>({ 1, 2, 3 }));
+        updates.clear();
+        target.Update(0.125f);
+        assert(updates == std::vector<int>({ 1, 2, 3, 4 }));
+
+        // Long frame is capped
+        updates.clear();
+        target.Update(10.0f);
+        assert(std::count(updates.begin(), updates.end(), 4) == 4);
+
+        // Without explicit delta time world measures time since previous update
+        updates.clear();
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        target.Update();
+        assert(std::count(updates.begin(), updates.end(), 4) >= 1);
+    }
+
+    workerManager.Stop();
+}
+
 void CommandBufferTest()
 {
     struct A
@@ -299,29 +637,306 @@ void CommandBufferTest()
     assert(manager.GetComponentData<B>(entity).Value == 20);
 }
 
-struct A : IPersistent<1>
+void ParallelCommandBufferTest()
 {
-    A() {}
-    A(int a) : Value(a) {}
+    struct A
+    {
+        A(int a) : Value(a) {}
+        int Value;
+    };
 
-    template<class Stream>
-    void Transfer(Stream& stream) { transfer(Value); }
+    struct B
+    {
+        B(int a) : Value(a) {}
+        int Value;
+    };
 
-    int Value;
-};
+    struct AddJob : IJobParallelFor
+    {
+        AddJob(EntityCommandBuffer::ParallelWriter writer, Entity* entities, int count) : Writer(writer), Entities(entities), Count(count) {}
+        virtual void Execute(int index)
+        {
+            // Reversed key, so playback order differs from entity order
+            Writer.AddComponentData(Count - 1 - index, Entities[index], B(index));
+        }
+        EntityCommandBuffer::ParallelWriter Writer;
+        Entity* Entities;
+        int Count;
+    };
 
-struct B : IPersistent<3>
+    WorkerManager workerManager;
+    workerManager.Start(4);
+
+    EntityManager manager;
+    auto archetype = manager.CreateArchetype({ typeof(A) });
+
+    const int count = 2000;
+    std::vector<Entity> entities;
+    for (int i = 0; i < count; ++i)
+    {
+        Entity entity = manager.CreateEntity(archetype);
+        manager.SetComponentData(entity, A(i));
+        entities.push_back(entity);
+    }
+
+    EntityCommandBuffer ecb(manager);
+    auto jobHandle = workerManager.ScheduleParallelFor(AddJob(ecb.AsParallelWriter(), entities.data(), count), count, 16);
+    workerManager.Complete(jobHandle);
+    ecb.Execute();
+
+    for (int i = 0; i < count; ++i)
+        assert(manager.GetComponentData<B>(entities[i]).Value == i);
+
+    // Entities are moved in sort key order no matter which worker recorded them
+    std::vector<int> order;
+    Query query(&manager);
+    query.ForEach([&](cread(B) b) { order.push_back(b.Value); }).Run();
+    assert(order.size() == count);
+    for (int i = 0; i < count; ++i)
+        assert(order[i] == count - 1 - i);
+
+    workerManager.Stop();
+}
+
+void PagedStreamTest()
 {
-    B() {}
-    B(int a) : Value(a) {}
+    PagePool pool;
 
-    template<class Stream>
-    void Transfer(Stream& stream) { transfer(Value); }
+    {
+        PagedStream stream(pool);
 
-    int Value;
-};
+        // Recorded data does not move while stream grows
+        std::vector<int*> values;
+        for (int i = 0; i < 50000; ++i)
+        {
+            auto value = (int*)stream.Allocate(sizeof(int), alignof(int));
+            *value = i;
+            values.push_back(value);
+        }
+        for (int i = 0; i < 50000; ++i)
+            assert(*values[i] == i);
+
+        // Allocation bigger than page and small allocations after it
+        stream.Allocate(PagePool::PageSize * 2);
+        stream.Write(12.5);
+        stream.Write('a');
+
+        PagedStream::Reader reader(stream);
+        for (int i = 0; i < 50000; ++i)
+            assert(*(int*)reader.Read(sizeof(int), alignof(int)) == i);
+        reader.Read(PagePool::PageSize * 2);
+        assert(*(double*)reader.Read(sizeof(double), alignof(double)) == 12.5);
+        assert(*(char*)reader.Read(sizeof(char), alignof(char)) == 'a');
+
+        stream.Clear();
+        assert(stream.Empty());
+    }
 
-void EntityManagerSerializeTest()
+    // Pages are recycled, only oversized page is released
+    int freeCount = pool.GetFreeCount();
+    assert(freeCount == 5);
+    {
+        PagedStream stream(pool);
+        stream.Allocate(1000);
+        assert(pool.GetFreeCount() == freeCount - 1);
+    }
+    assert(pool.GetFreeCount() == freeCount);
+}
+
+void EntityCommandBufferCommandsTest()
+{
+    struct A
+    {
+        A(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct B
+    {
+        B(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct SpawnJob : IJobParallelFor
+    {
+        SpawnJob(EntityCommandBuffer::ParallelWriter writer, EntityArchetype archetype) : Writer(writer), Archetype(archetype) {}
+        virtual void Execute(int index)
+        {
+            Entity entity = Writer.CreateEntity(index, Archetype);
+            Writer.SetComponentData(index, entity, A(index));
+            if (index % 2 == 0)
+                Writer.AddComponentData(index, entity, B(index));
+        }
+        EntityCommandBuffer::ParallelWriter Writer;
+        EntityArchetype Archetype;
+    };
+
+    EntityManager manager;
+    auto archetype = manager.CreateArchetype({ typeof(A) });
+
+    Entity entity = manager.CreateEntity(archetype);
+    manager.SetComponentData(entity, A(5));
+
+    EntityCommandBuffer ecb(manager);
+
+    // Commands are played in recording order
+    ecb.SetComponentData(entity, A(1));
+    ecb.SetComponentData(entity, A(2));
+    ecb.Execute();
+    assert(manager.GetComponentData<A>(entity).Value == 2);
+
+    // Placeholders can be used by following commands
+    Entity created = ecb.CreateEntity(archetype);
+    assert(EntityCommandBuffer::IsPlaceholder(created));
+    ecb.SetComponentData(created, A(10));
+    ecb.AddComponentData(created, B(11));
+    Entity instance = ecb.Instantiate(created);
+    ecb.SetComponentData(instance, A(12));
+    ecb.RemoveComponent<A>(entity);
+    ecb.DestroyEntity(entity);
+    ecb.Execute();
+
+    // Query include mask grows with every ForEach, so each check uses its own
+    std::vector<int> values;
+    Query(&manager).ForEach([&](cread(A) a, cread(B) b) { values.push_back(a.Value * 100 + b.Value); }).Run();
+    assert(values == std::vector<int>({ 1011, 1211 }));
+
+    int count = 0;
+    Query(&manager).ForEach([&](cread(A) a) { count++; }).Run();
+    assert(count == 2);
+
+    // Entity column follows entity when it changes archetype
+    values.clear();
+    Query(&manager).ForEach([&](Entity e, cread(B) b) { values.push_back(manager.GetComponentData<B>(e).Value); }).Run();
+    assert(values == std::vector<int>({ 11, 11 }));
+
+    // Same for commands recorded from jobs
+    WorkerManager workerManager;
+    workerManager.Start(4);
+
+    const int spawnCount = 1000;
+    auto jobHandle = workerManager.ScheduleParallelFor(SpawnJob(ecb.AsParallelWriter(), archetype), spawnCount, 16);
+    workerManager.Complete(jobHandle);
+    ecb.Execute();
+
+    count = 0;
+    Query(&manager).ForEach([&](cread(A) a) { count++; }).Run();
+    assert(count == spawnCount + 2);
+
+    values.clear();
+    Query(&manager).ForEach([&](cread(A) a, cread(B) b) { if (a.Value == b.Value) values.push_back(a.Value); }).Run();
+    assert(values.size() == spawnCount / 2);
+
+    workerManager.Stop();
+}
+
+void EntityCommandBufferBatchTest()
+{
+    struct A
+    {
+        A(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct B
+    {
+        B(int a) : Value(a) {}
+        int Value;
+    };
+
+    struct C
+    {
+        C(int a) : Value(a) {}
+        int Value;
+    };
+
+    EntityManager manager;
+    auto archetypeA = manager.CreateArchetype({ typeof(A) });
+    auto archetypeAC = manager.CreateArchetype({ typeof(A), typeof(C) });
+
+    // Entities of two archetypes are interleaved, so batch has to switch between source chunks
+    const int count = 3000;
+    std::vector<Entity> entities;
+    for (int i = 0; i < count; ++i)
+    {
+        Entity entity = manager.CreateEntity(i % 3 == 0 ? archetypeAC : archetypeA);
+        manager.SetComponentData(entity, A(i));
+        entities.push_back(entity);
+    }
+
+    auto validate = [&]()
+    {
+        Query(&manager).ForEach([&](Entity entity, cread(A) a) { assert(entities[a.Value].Index == entity.Index && entities[a.Value].Version == entity.Version); }).Run();
+    };
+
+    EntityCommandBuffer ecb(manager);
+
+    for (int i = 0; i < count; ++i)
+        ecb.AddComponentData(entities[i], B(i));
+    ecb.AddComponentData(entities[7], B(-7));
+    ecb.Execute();
+
+    validate();
+    for (int i = 0; i < count; ++i)
+    {
+        assert(manager.GetComponentData<A>(entities[i]).Value == i);
+        assert(manager.GetComponentData<B>(entities[i]).Value == (i == 7 ? -7 : i));
+    }
+
+    // Reverse order removes rows from the end of chunk first
+    for (int i = count - 1; i >= 0; i -= 2)
+        ecb.RemoveComponent<B>(entities[i]);
+    ecb.Execute();
+
+    validate();
+    int withB = 0;
+    Query(&manager).ForEach([&](cread(A) a, cread(B) b) { assert(a.Value % 2 == 0); withB++; }).Run();
+    assert(withB == count / 2);
+
+    for (int i = 0; i < count; i += 4)
+        ecb.DestroyEntity(entities[i]);
+    ecb.Execute();
+
+    validate();
+    int alive = 0;
+    Query(&manager).ForEach([&](cread(A) a) { assert(a.Value % 4 != 0); alive++; }).Run();
+    assert(alive == count - count / 4);
+
+    std::vector<Entity> placeholders;
+    for (int i = 0; i < 1000; ++i)
+        placeholders.push_back(ecb.CreateEntity(archetypeAC));
+    for (int i = 0; i < 1000; ++i)
+        ecb.SetComponentData(placeholders[i], C(i));
+    ecb.Execute();
+
+    int created = 0;
+    Query(&manager).ForEach([&](cread(C) c) { created++; }).Run();
+    assert(created == 1000 + (count / 3 - count / 12));
+}
+
+struct A : IPersistent<1>
+{
+    A() {}
+    A(int a) : Value(a) {}
+
+    template<class Stream>
+    void Transfer(Stream& stream) { transfer(Value); }
+
+    int Value;
+};
+
+struct B : IPersistent<3>
+{
+    B() {}
+    B(int a) : Value(a) {}
+
+    template<class Stream>
+    void Transfer(Stream& stream) { transfer(Value); }
+
+    int Value;
+};
+
+void EntityManagerSerializeTest()
 {
     EntityManager manager;
 
@@ -339,25 +954,724 @@ void EntityManagerSerializeTest()
     Entity entity2 = manager.CreateEntity(archetype2);
     manager.SetComponentData(entity2, B(3));
 
-    manager.DestroyEntity(entity4);
+    manager.DestroyEntity(entity4);
+
+    auto stream = YamlWriteStream2();
+    if (stream.Open("./Test.yaml"))
+    {
+        manager.Transfer(stream);
+        assert(stream.Close());
+    }
+
+    EntityManager manager2;
+
+    YamlReadStream2 readStream;
+    if (readStream.Open("./Test.yaml"))
+    {
+        manager2.Transfer(readStream);
+        assert(readStream.Close());
+    }
+
+    assert(manager == manager2);
+}
+
+void YamlReadStreamTest()
+{
+    // Windows line breaks and lines longer than read block
+    FILE* file = fopen("./TestRead.yaml", "wb");
+    assert(file != nullptr);
+    fprintf(file, "Value:   42\r\n");
+    fprintf(file, "Float: 0.25\r\n");
+    fprintf(file, "Guid: 1 2 3 4\r\n");
+    fprintf(file, "Values: [");
+    for (int i = 0; i < 20000; ++i)
+        fprintf(file, "%d, ", i);
+    fprintf(file, "]\r\n");
+    fprintf(file, "Name: ");
+    for (int i = 0; i < 1000; ++i)
+        fputc('a' + i % 26, file);
+    fprintf(file, "\r\n");
+    fprintf(file, "Last: 7");
+    fclose(file);
+
+    YamlReadStream2 stream;
+    assert(stream.Open("./TestRead.yaml"));
+
+    int value;
+    stream.Transfer("Value", value);
+    assert(value == 42);
+
+    float floatValue;
+    stream.Transfer("Float", floatValue);
+    assert(floatValue == 0.25f);
+
+    Guid guid;
+    stream.Transfer("Guid", guid);
+    assert(guid == Guid(1, 2, 3, 4));
+
+    std::vector<int> values;
+    stream.Transfer("Values", values);
+    assert(values.size() == 20000);
+    for (int i = 0; i < 20000; ++i)
+        assert(values[i] == i);
+
+    // Too long string is truncated
+    FixedString256 name;
+    stream.Transfer("Name", name);
+    assert(strlen(name.Data) == 255);
+    assert(name.Data[0] == 'a' && name.Data[254] == 'a' + 254 % 26);
+
+    stream.Transfer("Last", value);
+    assert(value == 7);
+
+    assert(stream.Close());
+}
+
+void YamlWriteStreamTest()
+{
+    // Floats are written without loss
+    std::vector<float> floats = { 0.1f, 1.0f / 3.0f, 1e-8f, 3.4e38f, -2.5f, 0.0f, 16777217.0f };
+    std::vector<int> ints = { 0, -1, INT_MAX, INT_MIN, 42 };
+    std::stack<int> stack;
+    stack.push(3);
+    stack.push(1);
+    stack.push(2);
+
+    YamlWriteStream2 stream;
+    assert(stream.Open("./TestWrite.yaml"));
+    for (auto& value : floats)
+        stream.Transfer("Float", value);
+    stream.Transfer("Ints", ints);
+    stream.Transfer("Stack", stack);
+    assert(stream.Close());
+
+    YamlReadStream2 readStream;
+    assert(readStream.Open("./TestWrite.yaml"));
+    for (auto& value : floats)
+    {
+        float readValue;
+        readStream.Transfer("Float", readValue);
+        assert(memcmp(&readValue, &value, sizeof(float)) == 0);
+    }
+
+    std::vector<int> readInts;
+    readStream.Transfer("Ints", readInts);
+    assert(readInts == ints);
+
+    std::stack<int> readStack;
+    readStream.Transfer("Stack", readStack);
+    assert(readStack == stack);
+    assert(readStream.Close());
+}
+
+void EntityManagerBinarySerializeTest()
+{
+    EntityManager manager;
+
+    auto archetype = manager.CreateArchetype({ typeof(A) });
+    auto archetype2 = manager.CreateArchetype({ typeof(A), typeof(B) });
+
+    std::vector<Entity> entities;
+    for (int i = 0; i < 3000; ++i)
+    {
+        Entity entity = manager.CreateEntity(i % 2 == 0 ? archetype : archetype2);
+        manager.SetComponentData(entity, A(i));
+        entities.push_back(entity);
+    }
+    for (int i = 0; i < 3000; i += 7)
+        manager.DestroyEntity(entities[i]);
+
+    auto stream = BinaryWriteStream();
+    if (stream.Open("./Test.bin"))
+    {
+        manager.Transfer(stream);
+        assert(stream.Close());
+    }
+
+    EntityManager manager2;
+
+    BinaryReadStream readStream;
+    if (readStream.Open("./Test.bin"))
+    {
+        manager2.Transfer(readStream);
+        assert(readStream.Close());
+    }
+
+    assert(manager == manager2);
+
+    // Entity column is loaded too, so loaded world can be changed
+    Query(&manager2).ForEach([&](Entity entity, cread(A) a) { assert(entities[a.Value].Index == entity.Index); }).Run();
+    manager2.DestroyEntity(entities[1]);
+    manager2.AddComponentData(entities[2], B(2));
+    assert(manager2.GetComponentData<A>(entities[2]).Value == 2);
+    assert(manager2.GetComponentData<A>(entities[3]).Value == 3);
+}
+
+void EntityManagerMappedLoadTest()
+{
+    EntityManager manager;
+
+    auto archetype = manager.CreateArchetype({ typeof(A) });
+    auto archetype2 = manager.CreateArchetype({ typeof(A), typeof(B) });
+
+    std::vector<Entity> entities;
+    for (int i = 0; i < 3000; ++i)
+    {
+        Entity entity = manager.CreateEntity(i % 2 == 0 ? archetype : archetype2);
+        manager.SetComponentData(entity, A(i));
+        entities.push_back(entity);
+    }
+
+    auto stream = BinaryWriteStream();
+    if (stream.Open("./TestMapped.bin"))
+    {
+        manager.Transfer(stream);
+        assert(stream.Close());
+    }
+
+    {
+        EntityManager manager2;
+
+        BinaryReadStream readStream;
+        if (readStream.OpenMapped("./TestMapped.bin"))
+        {
+            manager2.Transfer(readStream);
+            assert(readStream.Close());
+        }
+
+        assert(manager == manager2);
+
+        // Changes are private to loaded world, file stays as it was saved
+        manager2.SetComponentData(entities[10], A(-10));
+        manager2.AddComponentData(entities[12], B(12));
+        assert(manager2.GetComponentData<A>(entities[10]).Value == -10);
+        assert(manager2.GetComponentData<A>(entities[12]).Value == 12);
+    }
+
+    EntityManager manager3;
+
+    BinaryReadStream readStream;
+    if (readStream.OpenMapped("./TestMapped.bin", false))
+    {
+        manager3.Transfer(readStream);
+        assert(readStream.Close());
+    }
+
+    assert(manager == manager3);
+}
+
+void EntityManagerParallelSaveTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(4);
+
+    EntityManager manager;
+
+    std::vector<EntityArchetype> archetypes = {
+        manager.CreateArchetype({ typeof(A) }),
+        manager.CreateArchetype({ typeof(A), typeof(B) }),
+    };
+
+    for (int i = 0; i < 6000; ++i)
+    {
+        Entity entity = manager.CreateEntity(archetypes[i % archetypes.size()]);
+        manager.SetComponentData(entity, A(i));
+    }
+
+    auto stream = BinaryWriteStream();
+    if (stream.Open("./TestParallel.bin"))
+    {
+        manager.Save(stream, workerManager);
+        assert(stream.Close());
+    }
+
+    EntityManager manager2;
+    BinaryReadStream readStream;
+    if (readStream.Open("./TestParallel.bin"))
+    {
+        manager2.Load(readStream, workerManager);
+        assert(readStream.Close());
+    }
+    assert(manager == manager2);
+
+    EntityManager manager3;
+    if (readStream.OpenMapped("./TestParallel.bin"))
+    {
+        manager3.Load(readStream, workerManager);
+        assert(readStream.Close());
+    }
+    assert(manager == manager3);
+
+    workerManager.Stop();
+}
+
+void EntityManagerDeltaSnapshotTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(2);
+
+    EntityManager manager;
+
+    auto archetype = manager.CreateArchetype({ typeof(A) });
+    auto archetype2 = manager.CreateArchetype({ typeof(B) });
+    auto archetype3 = manager.CreateArchetype({ typeof(A), typeof(B) });
+
+    std::vector<Entity> entities;
+    for (int i = 0; i < 3000; ++i)
+    {
+        Entity entity = manager.CreateEntity(i % 3 == 0 ? archetype : (i % 3 == 1 ? archetype2 : archetype3));
+        if (i % 3 != 1)
+            manager.SetComponentData(entity, A(i));
+        entities.push_back(entity);
+    }
+
+    auto stream = BinaryWriteStream();
+    if (stream.Open("./TestDeltaBase.bin"))
+    {
+        manager.Save(stream, workerManager);
+        assert(stream.Close());
+    }
+
+    EntityManager loaded;
+    BinaryReadStream readStream;
+    if (readStream.Open("./TestDeltaBase.bin"))
+    {
+        loaded.Load(readStream, workerManager);
+        assert(readStream.Close());
+    }
+    assert(manager == loaded);
+
+    // Only chunk of first archetype is changed, so delta does not contain the others
+    manager.SetComponentData(entities[3], A(-3));
+    manager.DestroyEntity(entities[6]);
+    Entity created = manager.CreateEntity(archetype);
+
+    stream = BinaryWriteStream();
+    if (stream.Open("./TestDelta1.bin"))
+    {
+        manager.SaveDelta(stream);
+        assert(stream.Close());
+    }
+    assert(fs::file_size("./TestDelta1.bin") * 2 < fs::file_size("./TestDeltaBase.bin"));
+
+    if (readStream.Open("./TestDelta1.bin"))
+    {
+        loaded.LoadDelta(readStream);
+        assert(readStream.Close());
+    }
+    assert(manager == loaded);
+    assert(loaded.GetComponentData<A>(entities[3]).Value == -3);
+    assert(loaded.GetComponentData<A>(created).Value == manager.GetComponentData<A>(created).Value);
+
+    // Archetype moves and jobs writing components
+    manager.AddComponentData(entities[9], B(9));
+    manager.RemoveComponent<A>(entities[2]);
+    Query(&manager).ForEach([](cwrite(B) b) { b.Value = 7; }).Run();
+
+    stream = BinaryWriteStream();
+    if (stream.Open("./TestDelta2.bin"))
+    {
+        manager.SaveDelta(stream);
+        assert(stream.Close());
+    }
+
+    if (readStream.Open("./TestDelta2.bin"))
+    {
+        loaded.LoadDelta(readStream);
+        assert(readStream.Close());
+    }
+    assert(manager == loaded);
+    assert(loaded.GetComponentData<B>(entities[9]).Value == 7);
+
+    // Nothing changed since last delta
+    stream = BinaryWriteStream();
+    if (stream.Open("./TestDelta3.bin"))
+    {
+        manager.SaveDelta(stream);
+        assert(stream.Close());
+    }
+    assert(fs::file_size("./TestDelta3.bin") < 1024);
+
+    workerManager.Stop();
+}
+
+// Same component saved by older build, fields were reordered, removed and added
+struct SchemaV1 : IPersistent<20>
+{
+    SchemaV1() {}
+    SchemaV1(int health, float speed, int armor) : Health(health), Speed(speed), Armor(armor) {}
+
+    template<class Stream>
+    void Transfer(Stream& stream)
+    {
+        transfer(Health);
+        transfer(Speed);
+        transfer(Armor);
+    }
+
+    int Health;
+    float Speed;
+    int Armor;
+};
+
+struct SchemaV2 : IPersistent<21>
+{
+    SchemaV2() : Mana(100), Level(1) {}
+
+    template<class Stream>
+    void Transfer(Stream& stream)
+    {
+        transfer(Speed);
+        transfer(Health);
+        transfer(Mana);
+        transfer(Level);
+    }
+
+    float Speed;
+    int Health;
+    int Mana;
+    int Level;
+};
+
+// Replaces guid of saved component, so file looks like it was saved when component had other layout
+void ReplaceGuid(const char* path, const std::vector<byte>& from, const std::vector<byte>& to)
+{
+    FILE* file = fopen(path, "rb");
+    assert(file != nullptr);
+    std::vector<byte> data;
+    for (int c = fgetc(file); c != EOF; c = fgetc(file))
+        data.push_back(c);
+    fclose(file);
+
+    int replaced = 0;
+    for (auto it = std::search(data.begin(), data.end(), from.begin(), from.end()); it != data.end();
+        it = std::search(it + from.size(), data.end(), from.begin(), from.end()))
+    {
+        std::copy(to.begin(), to.end(), it);
+        replaced++;
+    }
+    assert(replaced != 0);
+
+    file = fopen(path, "wb");
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+}
+
+void TypeTreeMigrationTest()
+{
+    EntityManager manager;
+
+    auto archetype = manager.CreateArchetype({ typeof(SchemaV1), typeof(A) });
+    std::vector<Entity> entities;
+    for (int i = 0; i < 1000; ++i)
+    {
+        Entity entity = manager.CreateEntity(archetype);
+        manager.SetComponentData(entity, SchemaV1(i, i * 0.5f, -i));
+        manager.SetComponentData(entity, A(i));
+        entities.push_back(entity);
+    }
+
+    auto yamlStream = YamlWriteStream2();
+    if (yamlStream.Open("./TestMigration.yaml"))
+    {
+        manager.Transfer(yamlStream);
+        assert(yamlStream.Close());
+    }
+    ReplaceGuid("./TestMigration.yaml", { 'G', 'u', 'i', 'd', ':', ' ', '2', '0', ' ', '2', '0', ' ', '2', '0', ' ', '2', '0' },
+        { 'G', 'u', 'i', 'd', ':', ' ', '2', '1', ' ', '2', '1', ' ', '2', '1', ' ', '2', '1' });
+
+    auto binaryStream = BinaryWriteStream();
+    if (binaryStream.Open("./TestMigration.bin"))
+    {
+        manager.Transfer(binaryStream);
+        assert(binaryStream.Close());
+    }
+    Guid from = SchemaV1::Id;
+    Guid to = SchemaV2::Id;
+    ReplaceGuid("./TestMigration.bin", std::vector<byte>((byte*)&from, (byte*)(&from + 1)), std::vector<byte>((byte*)&to, (byte*)(&to + 1)));
+
+    EntityManager yamlManager;
+    YamlReadStream2 yamlReadStream;
+    if (yamlReadStream.Open("./TestMigration.yaml"))
+    {
+        yamlManager.Transfer(yamlReadStream);
+        assert(yamlReadStream.Close());
+    }
+
+    EntityManager binaryManager;
+    BinaryReadStream binaryReadStream;
+    if (binaryReadStream.Open("./TestMigration.bin"))
+    {
+        binaryManager.Transfer(binaryReadStream);
+        assert(binaryReadStream.Close());
+    }
+
+    for (auto loaded : { &yamlManager, &binaryManager })
+    {
+        int count = 0;
+        Query(loaded).ForEach([&](Entity entity, cread(SchemaV2) schema, cread(A) a)
+            {
+                assert(schema.Health == a.Value);
+                assert(schema.Speed == a.Value * 0.5f);
+                assert(schema.Mana == 100);
+                assert(schema.Level == 1);
+                count++;
+            }).Run();
+        assert(count == 1000);
+        assert(loaded->GetComponentData<A>(entities[10]).Value == 10);
+    }
+}
+
+struct Float3
+{
+    template<class Stream>
+    void Transfer(Stream& stream)
+    {
+        transfer(x);
+        transfer(y);
+        transfer(z);
+    }
+
+    float x;
+    float y;
+    float z;
+};
+
+struct Mixed : IPersistent<22>
+{
+    Mixed() {}
+
+    template<class Stream>
+    void Transfer(Stream& stream)
+    {
+        transfer(Position);
+        transfer(Values);
+        transfer(Points);
+        transfer(Big);
+        transfer(Flags);
+        transfer(Small);
+        transfer(Enabled);
+        transfer(Precise);
+    }
+
+    Float3 Position;
+    int Values[4];
+    Float3 Points[2];
+    long long Big;
+    unsigned char Flags;
+    short Small;
+    bool Enabled;
+    double Precise;
+};
+
+void TypeTreeLayoutTest()
+{
+    auto& typeTree = typeof(Mixed).GetTypeTree();
+    auto& fields = typeTree.Fields;
+    assert(typeTree.Size == sizeof(Mixed));
+    assert(fields.size() == 8);
+
+    assert(fields[0].Type == TypeTree::Type::Structure);
+    assert(fields[0].Offset == offsetof(Mixed, Position) && fields[0].Size == sizeof(Float3));
+    assert(fields[0].Fields.size() == 3 && fields[0].Fields[2].Offset == offsetof(Float3, z));
+
+    assert(fields[1].Type == TypeTree::Type::Array && fields[1].Length == 4 && fields[1].Size == sizeof(int) * 4);
+    assert(fields[1].Fields[0].Type == TypeTree::Type::Integer);
+
+    assert(fields[2].Type == TypeTree::Type::Array && fields[2].Offset == offsetof(Mixed, Points));
+    assert(fields[2].Fields[0].Type == TypeTree::Type::Structure && fields[2].Fields[0].Size == sizeof(Float3));
+
+    assert(fields[3].Type == TypeTree::Type::Int64 && fields[3].Offset == offsetof(Mixed, Big));
+    assert(fields[4].Type == TypeTree::Type::UInt8 && fields[4].Size == 1);
+    assert(fields[5].Type == TypeTree::Type::Int16 && fields[5].Offset == offsetof(Mixed, Small));
+    assert(fields[6].Type == TypeTree::Type::Boolean && fields[6].Size == sizeof(bool));
+    assert(fields[7].Type == TypeTree::Type::Double && fields[7].Offset == offsetof(Mixed, Precise));
+
+    // Text and binary streams write all fields
+    EntityManager manager;
+    auto archetype = manager.CreateArchetype({ typeof(Mixed), typeof(A) });
+    for (int i = 0; i < 500; ++i)
+    {
+        Mixed mixed;
+        mixed.Position = { i * 1.0f, i * 2.0f, i * 3.0f };
+        for (int j = 0; j < 4; ++j)
+            mixed.Values[j] = i + j;
+        mixed.Points[0] = { -1.0f, -2.0f, -3.0f };
+        mixed.Points[1] = { i * 0.1f, 0.0f, 1.0f };
+        mixed.Big = (1ll << 40) + i;
+        mixed.Flags = 255 - i % 256;
+        mixed.Small = -i;
+        mixed.Enabled = i % 2 == 0;
+        mixed.Precise = i / 3.0;
+
+        Entity entity = manager.CreateEntity(archetype);
+        manager.SetComponentData(entity, mixed);
+        manager.SetComponentData(entity, A(i));
+    }
+
+    auto yamlStream = YamlWriteStream2();
+    if (yamlStream.Open("./TestLayout.yaml"))
+    {
+        manager.Transfer(yamlStream);
+        assert(yamlStream.Close());
+    }
+
+    auto binaryStream = BinaryWriteStream();
+    if (binaryStream.Open("./TestLayout.bin"))
+    {
+        manager.Transfer(binaryStream);
+        assert(binaryStream.Close());
+    }
+
+    EntityManager yamlManager;
+    YamlReadStream2 yamlReadStream;
+    if (yamlReadStream.Open("./TestLayout.yaml"))
+    {
+        yamlManager.Transfer(yamlReadStream);
+        assert(yamlReadStream.Close());
+    }
+
+    EntityManager binaryManager;
+    BinaryReadStream binaryReadStream;
+    if (binaryReadStream.Open("./TestLayout.bin"))
+    {
+        binaryManager.Transfer(binaryReadStream);
+        assert(binaryReadStream.Close());
+    }
+
+    for (auto loaded : { &yamlManager, &binaryManager })
+    {
+        int count = 0;
+        Query(loaded).ForEach([&](Entity entity, cread(Mixed) mixed, cread(A) a)
+            {
+                int i = a.Value;
+                assert(mixed.Position.x == i * 1.0f && mixed.Position.y == i * 2.0f && mixed.Position.z == i * 3.0f);
+                for (int j = 0; j < 4; ++j)
+                    assert(mixed.Values[j] == i + j);
+                assert(mixed.Points[0].x == -1.0f && mixed.Points[0].z == -3.0f);
+                assert(mixed.Points[1].x == i * 0.1f && mixed.Points[1].z == 1.0f);
+                assert(mixed.Big == (1ll << 40) + i);
+                assert(mixed.Flags == 255 - i % 256);
+                assert(mixed.Small == -i);
+                assert(mixed.Enabled == (i % 2 == 0));
+                assert(mixed.Precise == i / 3.0);
+                count++;
+            }).Run();
+        assert(count == 500);
+    }
+
+    // Trees saved before fields had offsets are laid out as 4 byte scalars
+    FILE* file = fopen("./TestLegacyTree.yaml", "wb");
+    assert(file != nullptr);
+    fprintf(file, "TypeTree: # 2\n- Name: Value\n  Type: Integer\n- Name: Speed\n  Type: Float\n");
+    fclose(file);
+
+    TypeTree legacy;
+    YamlReadStream2 legacyStream;
+    assert(legacyStream.Open("./TestLegacyTree.yaml"));
+    legacyStream.Transfer("TypeTree", legacy);
+    assert(legacyStream.Close());
+    assert(legacy.Fields.size() == 2);
+    assert(legacy.Fields[1].Type == TypeTree::Type::Float && legacy.Fields[1].Offset == 4 && legacy.Fields[1].Size == 4);
+}
+
+void SnapshotCompressionTest()
+{
+    using namespace NodeVision::Compression;
+
+    std::vector<int> zeros(1000, 0);
+    std::vector<int> sequence(1000);
+    std::vector<int> noise(1000);
+    for (int i = 0; i < 1000; ++i)
+    {
+        sequence[i] = i * 3;
+        noise[i] = (int)((unsigned int)rand() * 7919u + rand());
+    }
+
+    for (auto column : { &zeros, &sequence, &noise })
+    {
+        for (int count : { 0, 1, 3, 1000 })
+        {
+            std::vector<byte> encoded;
+            EncodeColumn((byte*)column->data(), count, sizeof(int), encoded);
+
+            std::vector<int> decoded(count);
+            assert(DecodeColumn(encoded.data(), encoded.size(), (byte*)decoded.data(), count, sizeof(int)));
+            assert(decoded == std::vector<int>(column->begin(), column->begin() + count));
+        }
+    }
+
+    std::vector<byte> encoded;
+    EncodeColumn((byte*)sequence.data(), 1000, sizeof(int), encoded);
+    assert(encoded.size() < 100);
+    assert(!DecodeColumn(encoded.data(), encoded.size() - 1, (byte*)zeros.data(), 1000, sizeof(int)));
+
+    WorkerManager workerManager;
+    workerManager.Start(4);
 
-    auto stream = YamlWriteStream2();
-    if (stream.Open("./Test.yaml"))
+    EntityManager manager;
+    auto archetype = manager.CreateArchetype({ typeof(A) });
+    auto archetype2 = manager.CreateArchetype({ typeof(Mixed), typeof(A), typeof(B) });
+    for (int i = 0; i < 1000; ++i)
+    {
+        Mixed mixed;
+        memset(&mixed, 0, sizeof(mixed));
+        mixed.Position = { i * 1.0f, 0.0f, 1.0f };
+        mixed.Big = i;
+
+        Entity entity = manager.CreateEntity(i % 2 == 0 ? archetype : archetype2);
+        manager.SetComponentData(entity, A(i));
+        if (i % 2 == 1)
+        {
+            manager.SetComponentData(entity, B(-i));
+            manager.SetComponentData(entity, mixed);
+        }
+    }
+
+    auto stream = BinaryWriteStream();
+    if (stream.Open("./TestUncompressed.bin"))
     {
         manager.Transfer(stream);
         assert(stream.Close());
     }
 
-    EntityManager manager2;
+    if (stream.Open("./TestCompressed.bin", true))
+    {
+        manager.Transfer(stream);
+        assert(stream.Close());
+    }
 
-    YamlReadStream2 readStream;
-    if (readStream.Open("./Test.yaml"))
+    if (stream.Open("./TestCompressedParallel.bin", true))
     {
-        manager2.Transfer(readStream);
-        assert(readStream.Close());
+        manager.Save(stream, workerManager);
+        assert(stream.Close());
     }
 
-    assert(manager == manager2);
+    assert(fs::file_size("./TestCompressed.bin") * 4 < fs::file_size("./TestUncompressed.bin"));
+
+    // Compressed snapshots are decoded into own memory, mapped or not
+    for (bool mapped : { false, true })
+    {
+        EntityManager manager2;
+        BinaryReadStream readStream;
+        if (mapped ? readStream.OpenMapped("./TestCompressed.bin") : readStream.Open("./TestCompressed.bin"))
+        {
+            assert(readStream.IsCompressed());
+            manager2.Transfer(readStream);
+            assert(readStream.Close());
+        }
+        assert(manager == manager2);
+
+        EntityManager manager3;
+        if (mapped ? readStream.OpenMapped("./TestCompressedParallel.bin") : readStream.Open("./TestCompressedParallel.bin"))
+        {
+            manager3.Load(readStream, workerManager);
+            assert(readStream.Close());
+        }
+        assert(manager == manager3);
+    }
+
+    workerManager.Stop();
 }
 
 struct C : IDisposable
@@ -404,6 +1718,126 @@ void BlobReferenceTest()
     assert(GetBlobManager().Empty());
 }
 
+void GuidHashMapTest()
+{
+    // All words take part in ordering
+    assert(Guid(1, 2, 3, 4) < Guid(1, 2, 3, 5));
+    assert(Guid(1, 3, 0, 0) > Guid(1, 2, 9, 9));
+    assert(!(Guid(1, 2, 3, 4) < Guid(1, 2, 3, 4)));
+    assert(Guid(1, 0, 0, 0) < Guid(-1, 0, 0, 0));
+
+    HashMap<Guid, int> map;
+    for (int i = 0; i < 10000; ++i)
+        map[Guid(7, i, i % 3, 1)] = i;
+    assert(map.Count() == 10000);
+
+    for (int i = 0; i < 10000; i += 2)
+        assert(map.Erase(Guid(7, i, i % 3, 1)));
+    assert(!map.Erase(Guid(7, 0, 0, 1)));
+    assert(map.Count() == 5000);
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        auto value = map.Find(Guid(7, i, i % 3, 1));
+        assert(i % 2 == 0 ? value == nullptr : *value == i);
+    }
+
+    map.Clear();
+    assert(map.Empty() && !map.Contains(Guid(7, 1, 1, 1)));
+
+    // Blobs that share first word are different blobs
+    BlobManager blobManager;
+    SetBlobManager(&blobManager);
+
+    blobManager.CreateBlob(Guid(1, 1, 1, 1), 10);
+    blobManager.CreateBlob(Guid(1, 2, 2, 2), 20);
+    assert(blobManager.Count() == 2);
+    assert(blobManager.GetBlobValue<int>(Guid(1, 1, 1, 1)) == 10);
+    assert(blobManager.GetBlobValue<int>(Guid(1, 2, 2, 2)) == 20);
+
+    // Reference loaded before its blob leaves placeholder, which creating blob fills
+    blobManager.CreateBlob(Guid(1, 3, 3, 3));
+    assert(!blobManager.IsCreated(Guid(1, 3, 3, 3)));
+    blobManager.CreateBlob(Guid(1, 3, 3, 3), 30);
+    assert(blobManager.GetBlobValue<int>(Guid(1, 3, 3, 3)) == 30);
+}
+
+struct CurveKey
+{
+    float Time;
+    float Value;
+};
+
+struct Curve
+{
+    BlobString Name;
+    BlobArray<CurveKey> Keys;
+};
+
+struct Animation
+{
+    BlobArray<Curve> Curves;
+    BlobPtr<int> Loop;
+    float Length;
+};
+
+void BlobLayoutTest()
+{
+    BlobManager blobManager;
+    SetBlobManager(&blobManager);
+
+    BlobReference<Animation> reference;
+    {
+        BlobBuilder<Animation> builder;
+        auto& animation = builder.GetRoot();
+        animation.Length = 2.0f;
+        builder.Allocate(animation.Loop) = 3;
+
+        Curve* curves = builder.Allocate(animation.Curves, 3);
+        for (int i = 0; i < 3; ++i)
+        {
+            builder.AllocateString(curves[i].Name, i == 0 ? "Position" : i == 1 ? "Rotation" : "");
+
+            // Bigger than page, so it is not next to other allocations while building
+            CurveKey* keys = builder.Allocate(curves[i].Keys, i * 5000);
+            for (int j = 0; j < i * 5000; ++j)
+                keys[j] = { j * 0.1f, (float)(i + j) };
+        }
+
+        reference = builder.Build(Guid(5, 6, 7, 8));
+    }
+
+    auto check = [](const Animation& animation)
+    {
+        assert(animation.Length == 2.0f);
+        assert(animation.Loop.IsCreated() && animation.Loop.Value() == 3);
+        assert(animation.Curves.Length() == 3);
+        assert(animation.Curves[0].Name == "Position" && animation.Curves[1].Name == "Rotation");
+        assert(animation.Curves[2].Name.Length() == 0 && animation.Curves[2].Name == "");
+        for (int i = 0; i < 3; ++i)
+        {
+            auto& keys = animation.Curves[i].Keys;
+            assert(keys.Length() == i * 5000);
+            for (int j = 0; j < keys.Length(); ++j)
+                assert(keys[j].Time == j * 0.1f && keys[j].Value == i + j);
+        }
+    };
+
+    check(reference.Value());
+
+    // Blob has no pointers, so copy of its memory is valid too
+    int size = blobManager.GetBlobSize(reference.Guid);
+    assert(size >= sizeof(Animation) + sizeof(CurveKey) * 15000);
+    std::vector<std::max_align_t> copy(size / sizeof(std::max_align_t) + 1);
+    memcpy(copy.data(), &reference.Value(), size);
+    check(*(Animation*)copy.data());
+
+    // Type tree describes only root, so saving blob with allocations outside of it is rejected
+    assert(!blobManager.CanTransferBlob(reference.Guid));
+    blobManager.CreateBlob(Guid(5, 6, 7, 9), 10);
+    assert(blobManager.CanTransferBlob(Guid(5, 6, 7, 9)));
+}
+
 void JobsTest()
 {
     WorkerManager workerManager;
@@ -458,6 +1892,443 @@ void JobsTest()
     assert(result == (5 + 2) * (6 + 3));
 }
 
+void JobsWaitTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(2);
+
+    struct IncrementJob : IJob
+    {
+        IncrementJob(std::atomic<int>* counter) : Counter(counter) {}
+        virtual void Execute()
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            Counter->fetch_add(1);
+        }
+        std::atomic<int>* Counter;
+    };
+
+    std::atomic<int> counter = 0;
+
+    for (int i = 0; i < 64; ++i)
+        workerManager.Schedule(IncrementJob(&counter));
+
+    // Parks main thread until all jobs are done
+    workerManager.Wait();
+    assert(counter == 64);
+
+    workerManager.Stop();
+}
+
+void JobsWakeupTest()
+{
+    const int workerCount = 4;
+
+    struct EmptyJob : IJob
+    {
+        virtual void Execute() {}
+    };
+
+    // Passes only if all count jobs run at the same time, so every one of them needs its own awake worker
+    struct BarrierJob : IJob
+    {
+        BarrierJob(std::atomic<int>* arrived, std::atomic<int>* passed, int count) : Arrived(arrived), Passed(passed), Count(count) {}
+        virtual void Execute()
+        {
+            Arrived->fetch_add(1);
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+            while (*Arrived < Count && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::yield();
+            if (*Arrived >= Count)
+                Passed->fetch_add(1);
+        }
+        std::atomic<int>* Arrived;
+        std::atomic<int>* Passed;
+        int Count;
+    };
+
+    struct GateJob : IJob
+    {
+        GateJob(std::atomic<bool>* open) : Open(open) {}
+        virtual void Execute()
+        {
+            while (!*Open)
+                std::this_thread::yield();
+        }
+        std::atomic<bool>* Open;
+    };
+
+    auto waitParked = [](WorkerManager& workerManager, int count)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (workerManager.GetParkedWorkerCount() != count && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return workerManager.GetParkedWorkerCount() == count;
+    };
+
+    // Worker that found job right after listing itself stays on the stack, wakeup must skip it for the parked one
+    {
+        AutoResetEvent busyEvent;
+        AutoResetEvent parkedEvent;
+
+        IdleWorkerStack idleWorkers;
+        idleWorkers.Resize(2);
+        idleWorkers.Register(0, &busyEvent);
+        idleWorkers.Register(1, &parkedEvent);
+
+        idleWorkers.Park(1);
+        idleWorkers.Park(0);
+        assert(idleWorkers.Unpark(0));
+        assert(idleWorkers.GetParkedCount() == 1);
+
+        assert(idleWorkers.Wakeup(1) == 1);
+        assert(idleWorkers.GetParkedCount() == 0);
+        parkedEvent.WaitOne();
+    }
+
+    // Workers that are still spinning never park and pick up new job without being woken up
+    {
+        WorkerContext context;
+        context.SpinCount = INT_MAX;
+
+        WorkerManager workerManager;
+        workerManager.Start(std::vector<WorkerContext>(workerCount, context));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        assert(workerManager.GetParkedWorkerCount() == 0);
+        assert(workerManager.WakeupWorkers(1) == 0);
+
+        workerManager.Complete(workerManager.Schedule(EmptyJob()));
+        workerManager.Stop();
+    }
+
+    // Without spinning all workers park right away and every scheduled job wakes exactly one of them
+    {
+        WorkerContext context;
+        context.SpinCount = 0;
+        context.YieldCount = 0;
+
+        WorkerManager workerManager;
+        workerManager.Start(std::vector<WorkerContext>(workerCount, context));
+        assert(waitParked(workerManager, workerCount));
+
+        std::atomic<int> arrived = 0;
+        std::atomic<int> passed = 0;
+        for (int i = 0; i < workerCount; ++i)
+            workerManager.Schedule(BarrierJob(&arrived, &passed, workerCount));
+        workerManager.Wait();
+        assert(passed == workerCount);
+
+        // Worker completing gate releases all dependents, runs one itself and wakes parked workers for the rest
+        assert(waitParked(workerManager, workerCount));
+        std::atomic<bool> open = false;
+        auto gate = workerManager.Schedule(GateJob(&open));
+        arrived = 0;
+        passed = 0;
+        for (int i = 0; i < workerCount; ++i)
+            workerManager.Schedule(BarrierJob(&arrived, &passed, workerCount), gate);
+        assert(waitParked(workerManager, workerCount - 1));
+        open = true;
+        workerManager.Wait();
+        assert(passed == workerCount);
+
+        workerManager.Stop();
+    }
+}
+
+void JobsPayloadTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(2);
+
+    // Bigger than any payload class, goes directly to heap
+    struct BigJob : IJob
+    {
+        BigJob(int* result) : Result(result) { for (int i = 0; i < 4096; ++i) Values[i] = i; }
+        virtual void Execute()
+        {
+            int sum = 0;
+            for (int i = 0; i < 4096; ++i)
+                sum += Values[i];
+            *Result = sum;
+        }
+        int Values[4096];
+        int* Result;
+    };
+
+    // Not trivially copyable, must be copy constructed and destroyed after execution
+    struct VectorJob : IJob
+    {
+        VectorJob(std::vector<int> values, int* result) : Values(values), Result(result) {}
+        virtual void Execute()
+        {
+            for (auto value : Values)
+                *Result += value;
+        }
+        std::vector<int> Values;
+        int* Result;
+    };
+
+    int bigResult = 0;
+    int vectorResult = 0;
+
+    auto jobHandle0 = workerManager.Schedule(BigJob(&bigResult));
+    auto jobHandle1 = workerManager.Schedule(VectorJob({ 1, 2, 3, 4 }, &vectorResult), jobHandle0);
+    workerManager.Complete(jobHandle1);
+    workerManager.Wait();
+
+    assert(bigResult == 4095 * 4096 / 2);
+    assert(vectorResult == 10);
+
+    workerManager.Stop();
+}
+
+void JobsGraphTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(4);
+
+    struct SlowJob : IJob
+    {
+        virtual void Execute()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    struct IncrementJob : IJob
+    {
+        IncrementJob(std::atomic<int>* counter) : Counter(counter) {}
+        virtual void Execute() { Counter->fetch_add(1); }
+        std::atomic<int>* Counter;
+    };
+
+    std::atomic<int> counter = 0;
+
+    // Fan out from single job and fan in back to single job
+    auto root = workerManager.Schedule(SlowJob());
+    std::vector<JobHandle> jobHandles;
+    for (int i = 0; i < 500; ++i)
+        jobHandles.push_back(workerManager.Schedule(IncrementJob(&counter), root));
+    auto last = workerManager.Schedule(IncrementJob(&counter), workerManager.Combine(jobHandles));
+
+    workerManager.Complete(last);
+    assert(counter == 501);
+
+    workerManager.Stop();
+}
+
+void JobsPriorityTest()
+{
+    struct GateJob : IJob
+    {
+        GateJob(std::atomic<bool>* started, std::atomic<bool>* release) : Started(started), Release(release) {}
+        virtual void Execute()
+        {
+            *Started = true;
+            while (!*Release)
+                std::this_thread::yield();
+        }
+        std::atomic<bool>* Started;
+        std::atomic<bool>* Release;
+    };
+
+    struct RecordJob : IJob
+    {
+        RecordJob(std::vector<int>* order, int value) : Order(order), Value(value) {}
+        virtual void Execute() { Order->push_back(Value); }
+        std::vector<int>* Order;
+        int Value;
+    };
+
+    // Single worker executes jobs one by one, so order can be checked
+    {
+        WorkerManager workerManager;
+        workerManager.Start(1);
+
+        std::atomic<bool> started = false;
+        std::atomic<bool> release = false;
+        workerManager.Schedule(GateJob(&started, &release));
+        while (!started)
+            std::this_thread::yield();
+
+        std::vector<int> order;
+        for (int i = 0; i < 4; ++i)
+            workerManager.ScheduleWithPriority(JobPriority::Background, RecordJob(&order, 2));
+        workerManager.Schedule(RecordJob(&order, 1));
+        workerManager.ScheduleWithPriority(JobPriority::High, RecordJob(&order, 0));
+
+        release = true;
+        workerManager.Wait();
+
+        assert(order.size() == 6);
+        assert(order[0] == 0);
+        assert(order[1] == 1);
+
+        workerManager.Stop();
+    }
+
+    struct BackgroundJob : IJob
+    {
+        BackgroundJob(std::atomic<int>* running, std::atomic<int>* maxRunning) : Running(running), MaxRunning(maxRunning) {}
+        virtual void Execute()
+        {
+            int running = Running->fetch_add(1) + 1;
+            int maxRunning = *MaxRunning;
+            while (running > maxRunning && !MaxRunning->compare_exchange_weak(maxRunning, running));
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            Running->fetch_sub(1);
+        }
+        std::atomic<int>* Running;
+        std::atomic<int>* MaxRunning;
+    };
+
+    // Background jobs never take every worker
+    {
+        WorkerManager workerManager;
+        workerManager.Start(3);
+
+        std::atomic<int> running = 0;
+        std::atomic<int> maxRunning = 0;
+        for (int i = 0; i < 16; ++i)
+            workerManager.ScheduleWithPriority(JobPriority::Background, BackgroundJob(&running, &maxRunning));
+        workerManager.Wait();
+
+        assert(maxRunning <= 2);
+
+        workerManager.Stop();
+    }
+}
+
+void ParallelForTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(3);
+
+    struct SquareJob : IJobParallelFor
+    {
+        SquareJob(int* values) : Values(values) {}
+        virtual void Execute(int index)
+        {
+            Values[index] = index * index;
+        }
+        int* Values;
+    };
+
+    struct SumJob : IJob
+    {
+        SumJob(int* values, int length, long long* result) : Values(values), Length(length), Result(result) {}
+        virtual void Execute()
+        {
+            for (int i = 0; i < Length; ++i)
+                *Result += Values[i];
+        }
+        int* Values;
+        int Length;
+        long long* Result;
+    };
+
+    const int length = 10000;
+    std::vector<int> values(length, -1);
+    long long result = 0;
+
+    // Automatic batch size
+    auto jobHandle0 = workerManager.ScheduleParallelFor(SquareJob(values.data()), length, 0);
+    auto jobHandle1 = workerManager.Schedule(SumJob(values.data(), length, &result), jobHandle0);
+    workerManager.Complete(jobHandle1);
+    workerManager.Wait();
+
+    long long expected = 0;
+    for (int i = 0; i < length; ++i)
+        expected += (long long)i * i;
+    assert(result == expected);
+
+    // Explicit batch size that does not divide length
+    std::vector<int> values2(length, -1);
+    auto jobHandle2 = workerManager.ScheduleParallelFor(SquareJob(values2.data()), length, 7, jobHandle1);
+    workerManager.Complete(workerManager.Combine(jobHandle2));
+    workerManager.Wait();
+    assert(values == values2);
+
+    workerManager.Stop();
+}
+
+void JobsCoroutineTest()
+{
+    WorkerManager workerManager;
+    workerManager.Start(2);
+
+    struct AddJob : IJob
+    {
+        AddJob(int* value, int amount) : Value(value), Amount(amount) {}
+        virtual void Execute()
+        {
+            *Value += Amount;
+        }
+        int* Value;
+        int Amount;
+    };
+
+    // Every stage waits for jobs it scheduled, more pipelines than workers would deadlock if waiting blocked worker
+    auto pipeline = [](WorkerManager* workerManager, int* values) -> JobCoroutine
+    {
+        co_await workerManager->Schedule(AddJob(&values[0], 1));
+        values[1] = values[0] + 1;
+
+        auto first = workerManager->Schedule(AddJob(&values[2], 10));
+        auto second = workerManager->Schedule(AddJob(&values[3], 20));
+        co_await workerManager->Combine(first, second);
+        values[4] = values[1] + values[2] + values[3];
+    };
+
+    const int pipelineCount = 16;
+    std::vector<int> values(pipelineCount * 5, 0);
+    std::vector<JobHandle> jobHandles;
+    for (int i = 0; i < pipelineCount; ++i)
+        jobHandles.push_back(workerManager.Schedule(pipeline(&workerManager, &values[i * 5])));
+
+    auto jobHandle = workerManager.Combine(jobHandles);
+    workerManager.Complete(jobHandle);
+    for (int i = 0; i < pipelineCount; ++i)
+        assert(values[i * 5 + 4] == 32);
+
+    // Coroutine handle can be dependency of other jobs
+    auto jobHandle2 = workerManager.Schedule(pipeline(&workerManager, &values[0]), jobHandle);
+    auto jobHandle3 = workerManager.Schedule(AddJob(&values[4], 100), jobHandle2);
+    workerManager.Complete(jobHandle3);
+    assert(values[4] == 3 + 20 + 40 + 100);
+
+    workerManager.Stop();
+}
+
+void WorkerAffinityTest()
+{
+    CpuTopology topology;
+    if (!topology.Read())
+        return;
+
+    WorkerManager workerManager;
+    workerManager.Start(4, topology);
+
+    struct IndexJob : IJobParallelFor
+    {
+        IndexJob(int* values) : Values(values) {}
+        virtual void Execute(int index)
+        {
+            Values[index] = index;
+        }
+        int* Values;
+    };
+
+    const int length = 10000;
+    std::vector<int> values(length, -1);
+    workerManager.Complete(workerManager.ScheduleParallelFor(IndexJob(values.data()), length, 16));
+    workerManager.Wait();
+    for (int i = 0; i < length; ++i)
+        assert(values[i] == i);
+
+    workerManager.Stop();
+}
+
 void JobifiedEntityCommandBufferTest()
 {
     struct MyComponent
@@ -486,11 +2357,11 @@ void JobifiedEntityCommandBufferTest()
 
         virtual void OnUpdate()
         {
-            auto ecb = EcbSystem->GetBuffer();
+            auto ecb = EcbSystem->GetBuffer()->AsParallelWriter();
             auto dependency = Entities().ForEach(
                 [=](Entity entity, cwrite(MyComponent) myComponent)
                 {
-                    ecb->AddComponentData(entity, MyComponent2(4));
+                    ecb.AddComponentData(entity.Index, entity, MyComponent2(4));
                     //printf("Entity:(%d, %d) MyComponent:%f\n", entity.Index, entity.Version, myComponent.Value);
                 }).Schedule();
             EcbSystem->AddProducer(dependency);
@@ -706,10 +2577,36 @@ int main()
     run_test(EntityManagerTest);
     run_test(QueryTest);
     run_test(WorldTest);
+    run_test(SystemSchedulingTest);
+    run_test(CommandBufferProducersTest);
+    run_test(SystemGroupTest);
+    run_test(PagedStreamTest);
     run_test(CommandBufferTest);
+    run_test(ParallelCommandBufferTest);
+    run_test(EntityCommandBufferCommandsTest);
+    run_test(EntityCommandBufferBatchTest);
     run_test(BlobReferenceTest);
+    run_test(GuidHashMapTest);
+    run_test(BlobLayoutTest);
     run_test(JobsTest);
+    run_test(JobsWaitTest);
+    run_test(JobsWakeupTest);
+    run_test(JobsPayloadTest);
+    run_test(JobsGraphTest);
+    run_test(JobsPriorityTest);
+    run_test(ParallelForTest);
+    run_test(JobsCoroutineTest);
+    run_test(WorkerAffinityTest);
     run_test(EntityManagerSerializeTest);
+    run_test(YamlReadStreamTest);
+    run_test(YamlWriteStreamTest);
+    run_test(EntityManagerBinarySerializeTest);
+    run_test(EntityManagerMappedLoadTest);
+    run_test(EntityManagerParallelSaveTest);
+    run_test(EntityManagerDeltaSnapshotTest);
+    run_test(TypeTreeMigrationTest);
+    run_test(TypeTreeLayoutTest);
+    run_test(SnapshotCompressionTest);
     run_test(JobifiedEntityCommandBufferTest);
 
     // Run small demo
@@ -112,7 +112,7 @@ namespace NodeVision::Assets
     class AssetCommandBuffer
     {
     public:
-        AssetCommandBuffer() : Offset(0), Count(0) {}
+        AssetCommandBuffer() : Count(0) {}
 
         void SaveAsset(const Guid& guid)
         {
@@ -152,33 +152,16 @@ namespace NodeVision::Assets
         template<class T>
         void Write(const T& data)
         {
-            if (Data.size() - Offset <= sizeof(T))
-            {
-                int newSize = std::max(sizeof(T) * 2, Data.size() * 2);
-                Data.resize(newSize);
-            }
-
-            memcpy(Data.data() + Offset, (const char*)&data, sizeof(T));
-            Offset += sizeof(T);
+            Data.Write(data);
         }
 
         template<class T>
-        T& Read()
-        {
-            T* data = ((T*)(Data.data() + Offset));
-            Offset += sizeof(T);
-            return *data;
-        }
-
-        byte* Read(int length)
+        T& Read(PagedStream::Reader& reader)
         {
-            byte* data = Data.data() + Offset;
-            Offset += length;
-            return data;
+            return *(T*)reader.Read(sizeof(T), alignof(T));
         }
 
-        std::vector<byte> Data;
-        int Offset;
+        PagedStream Data;
         int Count;
     };
 
@@ -236,12 +219,16 @@ namespace NodeVision::Assets
 
         void SaveAsset(const FixedString256& path, const Guid& guid)
         {
+            auto& blobManager = GetBlobManager();
+            assert(blobManager.IsCreated(guid));
+
+            // Saving only root of blob built with offset pointers would silently drop the rest of it
+            if (!blobManager.CanTransferBlob(guid))
+                return;
+
             YamlWriteStream2 stream;
             if (stream.Open(path.Data))
             {
-                auto& blobManager = GetBlobManager();
-                assert(blobManager.IsCreated(guid));
-
                 blobManager.TransferBlob(stream, guid);
 
                 stream.Close();
@@ -266,7 +253,7 @@ namespace NodeVision::Assets
             if (blobManager.IsCreated(guid))
                 return;
 
-            if (m_GuidToEntity.contains(guid))
+            if (m_GuidToEntity.Contains(guid))
             {
                 Entity entity = m_GuidToEntity[guid];
                 Manager.AddComponentData(entity, RequestAssetImport());
@@ -279,7 +266,7 @@ namespace NodeVision::Assets
             auto& blobManager = GetBlobManager();
             blobManager.CreateBlob(guid, typeTree, data);
 
-            assert(m_GuidToEntity.contains(guid));
+            assert(m_GuidToEntity.Contains(guid));
             Entity entity = m_GuidToEntity[guid];
             //Manager.RemoveComponentData(entity, RequestAssetImport());
         }
@@ -304,8 +291,10 @@ namespace NodeVision::Assets
                             TypeTree typeTree;
                             stream.Transfer("TypeTree", typeTree);
 
+                            // Yaml type tree does not store size, blob is only its root as saving rejects anything else
                             int size;
                             stream.Transfer("Size", size);
+                            typeTree.Size = size;
 
                             byte* data = new byte[size];
                             stream.Transfer(typeTree, data, 1);
@@ -354,7 +343,7 @@ namespace NodeVision::Assets
                 return;
             }
 
-            if (m_GuidToEntity.contains(meta.Guid))
+            if (m_GuidToEntity.Contains(meta.Guid))
                 return;
 
             auto archetype = EntityArchetype({ GetComponentType<Entity>(), GetComponentType<Asset>() });
@@ -372,22 +361,22 @@ namespace NodeVision::Assets
 
     private:
         AssetCommandBuffer m_AssetCommandBuffer;
-        std::map<Guid, Entity> m_GuidToEntity;
+        HashMap<Guid, Entity> m_GuidToEntity;
     };
 
     void AssetCommandBuffer::Execute(ImportSystem& importSystem)
     {
-        Offset = 0;
+        PagedStream::Reader reader(Data);
         while (Count != 0)
         {
-            Command command = Read<Command>();
+            Command command = Read<Command>(reader);
 
             switch (command)
             {
             case Command::Export:
             {
-                auto& path = Read<FixedString256>();
-                auto& guid = Read<Guid>();
+                auto& path = Read<FixedString256>(reader);
+                auto& guid = Read<Guid>(reader);
                 importSystem.SaveAsset(path, guid);
                 Count--;
                 break;
@@ -395,7 +384,7 @@ namespace NodeVision::Assets
 
             case Command::Import:
             {
-                auto& guid = Read<Guid>();
+                auto& guid = Read<Guid>(reader);
                 importSystem.LoadAsset(guid);
                 Count--;
                 break;
@@ -403,9 +392,9 @@ namespace NodeVision::Assets
 
             case Command::Create:
             {
-                auto& guid = Read<Guid>();
-                auto& typeTree = Read<TypeTree>();
-                auto& ptr = Read<byte*>();
+                auto& guid = Read<Guid>(reader);
+                auto& typeTree = Read<TypeTree>(reader);
+                auto& ptr = Read<byte*>(reader);
                 importSystem.UpdateAsset(guid, typeTree, ptr);
                 Count--;
                 break;
@@ -417,7 +406,7 @@ namespace NodeVision::Assets
             }
         }
 
-        Offset = 0;
+        Data.Clear();
         assert(Count == 0);
     }
 
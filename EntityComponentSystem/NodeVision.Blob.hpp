@@ -3,6 +3,7 @@
 #include "NodeVision.Serialization.hpp"
 #include "NodeVision.Collections.hpp"
 #include <map>
+#include <cstddef>
 
 namespace NodeVision::Blob
 {
@@ -15,26 +16,37 @@ namespace NodeVision::Blob
         template<class T>
         void CreateBlob(const Guid& guid, const T& data)
         {
-            if (Blobs.contains(guid))
+            byte* copy = new byte[sizeof(T)];
+            memcpy(copy, &data, sizeof(T));
+            CreateBlob<T>(guid, copy, sizeof(T));
+        }
+
+        // Takes ownership of data, size includes memory referenced by offset pointers of root
+        template<class T>
+        void CreateBlob(const Guid& guid, byte* data, int size)
+        {
+            if (Blobs.Contains(guid))
             {
+                // Only placeholder of reference that came before blob can exist, values of built blob can still be in use
                 Blob& blob = Blobs[guid];
-                blob.Data = new byte[sizeof(T)];
-                memcpy(blob.Data, &data, sizeof(T));
+                assert(blob.Data == nullptr && "Blob with this guid is already created");
+                blob.Data = data;
+                blob.Size = size;
                 blob.ReferenceCount++;
             }
             else
             {
                 Blob blob;
-                blob.Data = new byte[sizeof(T)];
-                memcpy(blob.Data, &data, sizeof(T));
+                blob.Data = data;
+                blob.Size = size;
                 blob.ReferenceCount = 0;
+                blob.TypeTree.Size = sizeof(T);
 
                 // Create persistent component type
                 if constexpr (std::is_base_of<ITest, T>::value)
                 {
-                    TypeTreeStream stream(blob.TypeTree);
-                    blob.TypeTree.Size = sizeof(T);
-                    ((T&)data).Transfer(stream);
+                    TypeTreeStream stream(blob.TypeTree, data);
+                    ((T*)data)->Transfer(stream);
                 }
 
                 Blobs[guid] = blob;
@@ -43,16 +55,18 @@ namespace NodeVision::Blob
 
         void CreateBlob(const Guid& guid, const TypeTree& typeTree, byte* data)
         {
-            if (Blobs.contains(guid))
+            if (Blobs.Contains(guid))
             {
                 Blob& blob = Blobs[guid];
                 blob.Data = data;
+                blob.Size = typeTree.Size;
                 blob.TypeTree = typeTree;
             }
             else
             {
                 Blob blob;
                 blob.Data = data;
+                blob.Size = typeTree.Size;
                 blob.ReferenceCount = 0;
                 blob.TypeTree = typeTree;
                 Blobs[guid] = blob;
@@ -61,7 +75,7 @@ namespace NodeVision::Blob
 
         void CreateBlob(const Guid& guid)
         {
-            if (Blobs.contains(guid))
+            if (Blobs.Contains(guid))
             {
                 Blob& blob = Blobs[guid];
                 blob.ReferenceCount++;
@@ -70,6 +84,7 @@ namespace NodeVision::Blob
             {
                 Blob blob;
                 blob.Data = nullptr;
+                blob.Size = 0;
                 blob.ReferenceCount = 0;
                 Blobs[guid] = blob;
             }
@@ -77,7 +92,7 @@ namespace NodeVision::Blob
 
         void IncreaseReferenceCount(const Guid& guid)
         {
-            assert(Blobs.contains(guid));
+            assert(Blobs.Contains(guid));
 
             auto& blob = Blobs[guid];
             blob.ReferenceCount++;
@@ -88,7 +103,7 @@ namespace NodeVision::Blob
 
         void DecreaseReferenceCount(const Guid& guid)
         {
-            assert(Blobs.contains(guid));
+            assert(Blobs.Contains(guid));
 
             auto& blob = Blobs[guid];
             blob.ReferenceCount--;
@@ -98,8 +113,8 @@ namespace NodeVision::Blob
             if (blob.ReferenceCount == 0)
             {
                 if (blob.Data != nullptr)
-                    delete blob.Data;
-                Blobs.erase(guid);
+                    delete[] blob.Data;
+                Blobs.Erase(guid);
                 printf("delete\n");
             }
         }
@@ -107,15 +122,29 @@ namespace NodeVision::Blob
         template<class T>
         T& GetBlobValue(const Guid& guid)
         {
-            assert(Blobs.contains(guid));
+            assert(Blobs.Contains(guid));
             auto& blob = Blobs[guid];
             return *(T*)blob.Data;
         }
 
+        int GetBlobSize(const Guid& guid)
+        {
+            assert(Blobs.Contains(guid));
+            return Blobs[guid].Size;
+        }
+
+        // Type tree does not describe offset pointers, so blob with allocations outside of its root can not be transferred
+        bool CanTransferBlob(const Guid& guid)
+        {
+            assert(Blobs.Contains(guid));
+            auto& blob = Blobs[guid];
+            return blob.Data != nullptr && blob.Size == blob.TypeTree.Size;
+        }
+
         template<class Stream>
         void TransferBlob(Stream& stream, const Guid& guid)
         {
-            assert(Blobs.contains(guid));
+            assert(CanTransferBlob(guid));
             auto& blob = Blobs[guid];
 
             stream.Transfer("TypeTree", blob.TypeTree);
@@ -125,24 +154,25 @@ namespace NodeVision::Blob
 
         bool IsCreated(const Guid& guid)
         {
-            if (!Blobs.contains(guid))
+            if (!Blobs.Contains(guid))
                 return false;
 
             return Blobs[guid].Data != nullptr;
         }
 
-        bool Empty() const { return Blobs.empty(); }
-        size_t Count() const { return Blobs.size(); }
+        bool Empty() const { return Blobs.Empty(); }
+        size_t Count() const { return Blobs.Count(); }
 
     private:
         struct Blob
         {
             TypeTree TypeTree;
             byte* Data;
+            int Size;
             int ReferenceCount; // todo atomic
         };
 
-        std::map<Guid, Blob> Blobs;
+        HashMap<Guid, Blob> Blobs;
     };
 
     static BlobManager* g_BlobManager = nullptr;
@@ -235,17 +265,146 @@ namespace NodeVision::Blob
         Guid Guid;
     };
 
+    // Offset from itself to value, so blob can be copied or mapped without pointer fixups. Only valid inside blob.
+    template<class T>
+    struct BlobPtr
+    {
+        BlobPtr() : offset(0) {}
+        BlobPtr(const BlobPtr&) = delete;
+        void operator=(const BlobPtr&) = delete;
+
+        T& Value() const
+        {
+            assert(IsCreated());
+            return *(T*)((byte*)&offset + offset);
+        }
+
+        T* operator->() const { return &Value(); }
+        bool IsCreated() const { return offset != 0; }
+
+    private:
+        template<class> friend class BlobBuilder;
+
+        int offset;
+    };
+
+    template<class T>
+    struct BlobArray
+    {
+        BlobArray() : offset(0), length(0) {}
+        BlobArray(const BlobArray&) = delete;
+        void operator=(const BlobArray&) = delete;
+
+        T* Data() const { return (T*)((byte*)&offset + offset); }
+        int Length() const { return length; }
+
+        T& operator[](int i) const
+        {
+            assert(0 <= i && i < length);
+            return Data()[i];
+        }
+
+    private:
+        template<class> friend class BlobBuilder;
+
+        int offset;
+        int length;
+    };
+
+    // Null terminated, terminator is not part of length
+    struct BlobString : BlobArray<char>
+    {
+        operator const char*() const { return Data(); }
+
+        bool operator==(const char* value) const
+        {
+            return strcmp(Data(), value) == 0;
+        }
+    };
+
+    // Blob is copied bitwise and never destroyed, so values can not own memory outside of it. Offset pointers are
+    // not copyable on their own, which makes types holding them not trivially copyable, so destruction is checked.
+    template<class T>
+    inline constexpr bool IsBlobValue = std::is_trivially_destructible<T>::value && !std::is_polymorphic<T>::value;
+
+    // Root and everything allocated for its offset pointers is laid out into single allocation once blob is built
     template<class T>
     class BlobBuilder
     {
+        static_assert(IsBlobValue<T>, "Blob root must be trivially destructible, use BlobArray and BlobPtr instead of owning containers");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Blob is allocated with new byte[], which aligns only up to max_align_t");
+
     public:
-        T& GetRoot() { return Value; }
+        BlobBuilder()
+        {
+            Root = new (Allocate(sizeof(T), alignof(T))) T();
+        }
+
+        T& GetRoot() { return *Root; }
+
+        // Array can be part of root or of any other allocation of this builder
+        template<class E>
+        E* Allocate(BlobArray<E>& array, int length)
+        {
+            static_assert(IsBlobValue<E>, "Blob values must be trivially destructible, use BlobArray and BlobPtr instead of owning containers");
+            static_assert(alignof(E) <= alignof(std::max_align_t), "Blob is allocated with new byte[], which aligns only up to max_align_t");
+
+            E* data = (E*)Allocate(sizeof(E) * length, alignof(E));
+            for (int i = 0; i < length; ++i)
+                new (data + i) E();
+
+            AddPatch(&array.offset);
+            array.length = length;
+            return data;
+        }
+
+        template<class E>
+        E& Allocate(BlobPtr<E>& ptr)
+        {
+            static_assert(IsBlobValue<E>, "Blob values must be trivially destructible, use BlobArray and BlobPtr instead of owning containers");
+            static_assert(alignof(E) <= alignof(std::max_align_t), "Blob is allocated with new byte[], which aligns only up to max_align_t");
+
+            E* data = new (Allocate(sizeof(E), alignof(E))) E();
+
+            AddPatch(&ptr.offset);
+            return *data;
+        }
+
+        void AllocateString(BlobString& string, const char* value)
+        {
+            int length = strlen(value);
+            char* data = Allocate(string, length + 1);
+            memcpy(data, value, length + 1);
+            string.length = length;
+        }
 
         BlobReference<T> Build(const Guid& guid)
         {
+            std::vector<int> positions(Allocations.size());
+            int size = 0;
+            for (int i = 0; i < Allocations.size(); ++i)
+            {
+                size = (size + Allocations[i].Alignment - 1) & ~(Allocations[i].Alignment - 1);
+                positions[i] = size;
+                size += Allocations[i].Size;
+            }
+
+            byte* data = new byte[size];
+            for (int i = 0; i < Allocations.size(); ++i)
+                memcpy(data + positions[i], Allocations[i].Data, Allocations[i].Size);
+
+            // Offsets are relative to final position of field
+            for (auto& patch : Patches)
+            {
+                int index = patch.Owner;
+                int position = positions[index] + ((byte*)patch.Field - Allocations[index].Data);
+                int offset = positions[patch.Target] - position;
+                memcpy(data + position, &offset, sizeof(offset));
+            }
+
             auto& blobManager = GetBlobManager();
 
-            blobManager.CreateBlob(guid, Value);
+            blobManager.CreateBlob<T>(guid, data, size);
 
             BlobReference<T> reference;
             reference.Guid = guid;
@@ -254,6 +413,52 @@ namespace NodeVision::Blob
         }
 
     private:
-        T Value;
+        struct Allocation
+        {
+            byte* Data;
+            int Size;
+            int Alignment;
+        };
+
+        struct Patch
+        {
+            int* Field;
+            int Owner; // Allocation that contains field
+            int Target;
+        };
+
+        byte* Allocate(int size, int alignment)
+        {
+            byte* data = Data.Allocate(size, alignment);
+            AllocationIndices[data] = Allocations.size();
+            Allocations.push_back({ data, size, alignment });
+            return data;
+        }
+
+        void AddPatch(int* field)
+        {
+            int owner = FindAllocation((byte*)field);
+            assert(owner != -1);
+            Patches.push_back({ field, owner, (int)Allocations.size() - 1 });
+        }
+
+        // Allocation containing address, found by last allocation that starts at or before it
+        int FindAllocation(byte* address)
+        {
+            auto next = AllocationIndices.upper_bound(address);
+            if (next == AllocationIndices.begin())
+                return -1;
+
+            int index = std::prev(next)->second;
+            if (address < Allocations[index].Data + Allocations[index].Size)
+                return index;
+            return -1;
+        }
+
+        PagedStream Data;
+        std::vector<Allocation> Allocations;
+        std::map<byte*, int> AllocationIndices; // Start address to index, so patches find their allocation in log time
+        std::vector<Patch> Patches;
+        T* Root;
     };
 }
\ No newline at end of file
@@ -5,6 +5,10 @@
 #include "assert.h"
 #include "vector"
 #include <string>
+#include <cstddef>
+#include <mutex>
+#include <functional>
+#include "NodeVision.Core.hpp"
 
 namespace NodeVision
 {
@@ -171,5 +175,295 @@ namespace NodeVision
             T* data;
             int length;
         };
+
+        // Fixed size pages shared by append only streams. Pages are kept after streams are cleared, so recording in
+        // steady state does not allocate.
+        class PagePool
+        {
+        public:
+            static const int PageSize = 64 * 1024;
+
+            ~PagePool()
+            {
+                for (auto page : FreePages)
+                    delete[] page;
+            }
+
+            byte* Allocate()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(Protect);
+                    if (!FreePages.empty())
+                    {
+                        byte* page = FreePages.back();
+                        FreePages.pop_back();
+                        return page;
+                    }
+                }
+                return new byte[PageSize];
+            }
+
+            void Free(byte* page)
+            {
+                std::lock_guard<std::mutex> lock(Protect);
+                FreePages.push_back(page);
+            }
+
+            int GetFreeCount()
+            {
+                std::lock_guard<std::mutex> lock(Protect);
+                return FreePages.size();
+            }
+
+        private:
+            std::mutex Protect;
+            std::vector<byte*> FreePages;
+        };
+
+        PagePool& GetPagePool()
+        {
+            static PagePool pagePool;
+            return pagePool;
+        }
+
+        // Append only stream stored in linked pages. Recorded data never moves and single allocation never spans
+        // two pages, so it can be read in place. Allocations bigger than page get their own page.
+        class PagedStream
+        {
+        public:
+            struct Page
+            {
+                Page* Next;
+                int Size; // Used bytes
+                int Capacity;
+
+                byte* Data() { return (byte*)this + HeaderSize; }
+            };
+
+            static const int HeaderSize = (sizeof(Page) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+            // Reads back allocations in order they were made, sizes and alignments must match
+            class Reader
+            {
+            public:
+                Reader(const PagedStream& stream) : Current(stream.First), Offset(0) {}
+
+                byte* Read(int size, int alignment = alignof(std::max_align_t))
+                {
+                    assert(Current != nullptr);
+                    Offset = Align(Offset, alignment);
+                    if (Offset + size > Current->Size)
+                    {
+                        Current = Current->Next;
+                        Offset = 0;
+                        assert(Current != nullptr && size <= Current->Size);
+                    }
+                    byte* data = Current->Data() + Offset;
+                    Offset += size;
+                    return data;
+                }
+
+            private:
+                Page* Current;
+                int Offset;
+            };
+
+            PagedStream(PagePool& pool = GetPagePool()) : Pool(&pool), First(nullptr), Last(nullptr) {}
+            PagedStream(const PagedStream&) = delete;
+            PagedStream(PagedStream&& other) : Pool(other.Pool), First(other.First), Last(other.Last)
+            {
+                other.First = nullptr;
+                other.Last = nullptr;
+            }
+            ~PagedStream() { Clear(); }
+
+            byte* Allocate(int size, int alignment = alignof(std::max_align_t))
+            {
+                assert(alignment <= alignof(std::max_align_t));
+
+                int offset = Last != nullptr ? Align(Last->Size, alignment) : 0;
+                if (Last == nullptr || offset + size > Last->Capacity)
+                {
+                    AddPage(size);
+                    offset = 0;
+                }
+
+                byte* data = Last->Data() + offset;
+                Last->Size = offset + size;
+                return data;
+            }
+
+            template<class T>
+            void Write(const T& data)
+            {
+                memcpy(Allocate(sizeof(T), alignof(T)), &data, sizeof(T));
+            }
+
+            // Gives pages back to pool
+            void Clear()
+            {
+                while (First != nullptr)
+                {
+                    Page* next = First->Next;
+                    if (First->Capacity == PagePool::PageSize - HeaderSize)
+                        Pool->Free((byte*)First);
+                    else
+                        delete[] (byte*)First;
+                    First = next;
+                }
+                Last = nullptr;
+            }
+
+            bool Empty() const { return First == nullptr; }
+            Page* GetFirstPage() const { return First; }
+
+        private:
+            static int Align(int offset, int alignment) { return (offset + alignment - 1) & ~(alignment - 1); }
+
+            void AddPage(int size)
+            {
+                Page* page;
+                if (size <= PagePool::PageSize - HeaderSize)
+                {
+                    page = (Page*)Pool->Allocate();
+                    page->Capacity = PagePool::PageSize - HeaderSize;
+                }
+                else
+                {
+                    page = (Page*)new byte[HeaderSize + size];
+                    page->Capacity = size;
+                }
+                page->Next = nullptr;
+                page->Size = 0;
+
+                if (Last != nullptr)
+                    Last->Next = page;
+                else
+                    First = page;
+                Last = page;
+            }
+
+            PagePool* Pool;
+            Page* First;
+            Page* Last;
+        };
+
+        // Open addressing map with linear probing. Capacity is power of two and erase shifts following entries back,
+        // so lookups never need tombstones. References are invalidated when map grows.
+        template<class K, class V, class H = std::hash<K>>
+        class HashMap
+        {
+        public:
+            HashMap() : count(0) {}
+
+            V& operator[](const K& key)
+            {
+                if ((count + 1) * 4 > (int)entries.size() * 3)
+                    Grow();
+
+                int index = GetIndex(key);
+                while (entries[index].Used)
+                {
+                    if (entries[index].Key == key)
+                        return entries[index].Value;
+                    index = (index + 1) & GetMask();
+                }
+
+                entries[index].Key = key;
+                entries[index].Used = true;
+                count++;
+                return entries[index].Value;
+            }
+
+            V* Find(const K& key)
+            {
+                int index = FindIndex(key);
+                return index != -1 ? &entries[index].Value : nullptr;
+            }
+
+            const V* Find(const K& key) const
+            {
+                int index = FindIndex(key);
+                return index != -1 ? &entries[index].Value : nullptr;
+            }
+
+            bool Contains(const K& key) const { return FindIndex(key) != -1; }
+
+            bool Erase(const K& key)
+            {
+                int hole = FindIndex(key);
+                if (hole == -1)
+                    return false;
+
+                entries[hole] = Entry();
+                count--;
+
+                // Moves back entries that probed past the hole
+                int index = (hole + 1) & GetMask();
+                while (entries[index].Used)
+                {
+                    int home = GetIndex(entries[index].Key);
+                    if (((index - home) & GetMask()) >= ((index - hole) & GetMask()))
+                    {
+                        entries[hole] = std::move(entries[index]);
+                        entries[index] = Entry();
+                        hole = index;
+                    }
+                    index = (index + 1) & GetMask();
+                }
+                return true;
+            }
+
+            void Clear()
+            {
+                entries.clear();
+                count = 0;
+            }
+
+            bool Empty() const { return count == 0; }
+            int Count() const { return count; }
+
+        private:
+            struct Entry
+            {
+                K Key;
+                V Value;
+                bool Used = false;
+            };
+
+            int GetMask() const { return entries.size() - 1; }
+            int GetIndex(const K& key) const { return H()(key) & GetMask(); }
+
+            int FindIndex(const K& key) const
+            {
+                if (count == 0)
+                    return -1;
+
+                int index = GetIndex(key);
+                while (entries[index].Used)
+                {
+                    if (entries[index].Key == key)
+                        return index;
+                    index = (index + 1) & GetMask();
+                }
+                return -1;
+            }
+
+            void Grow()
+            {
+                std::vector<Entry> oldEntries = std::move(entries);
+                entries = std::vector<Entry>(oldEntries.empty() ? 16 : oldEntries.size() * 2);
+                count = 0;
+
+                for (auto& entry : oldEntries)
+                {
+                    if (entry.Used)
+                        (*this)[entry.Key] = std::move(entry.Value);
+                }
+            }
+
+            std::vector<Entry> entries;
+            int count;
+        };
     }
 }
\ No newline at end of file
@@ -23,8 +23,9 @@ namespace NodeVision::CommandBuffer
             }
             else
             {
-                auto buffer = UsedBuffers.back();
-                UsedBuffers.pop_back();
+                auto buffer = FreeBuffers.back();
+                FreeBuffers.pop_back();
+                UsedBuffers.push_back(buffer);
                 return buffer;
             }
         }
@@ -56,6 +57,10 @@ namespace NodeVision::CommandBuffer
             {
                 delete buffer;
             }
+            for (auto buffer : FreeBuffers)
+            {
+                delete buffer;
+            }
         }
 
     private:
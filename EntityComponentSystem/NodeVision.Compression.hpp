@@ -0,0 +1,287 @@
+#pragma once
+
+#include "string.h"
+#include "assert.h"
+#include "vector"
+#include <algorithm>
+#include "NodeVision.Core.hpp"
+
+namespace NodeVision::Compression
+{
+    // Byte codec with LZ4 block layout. Sequence is token with literal and match length, literals, two byte offset
+    // and rest of match length. Last sequence has only literals.
+    namespace Lz4
+    {
+        static const int MinMatch = 4;
+        static const int LastLiterals = 5; // Sequence can not copy match into last bytes
+        static const int MatchLimit = 12; // Match can not start in last bytes
+        static const int HashBits = 12;
+        static const int MaxOffset = 65535;
+
+        inline int GetMaxCompressedSize(int size)
+        {
+            return size + size / 255 + 16;
+        }
+
+        inline unsigned int Read32(const unsigned char* data)
+        {
+            unsigned int value;
+            memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        inline int Hash(unsigned int sequence)
+        {
+            return (sequence * 2654435761u) >> (32 - HashBits);
+        }
+
+        inline unsigned char* WriteLength(unsigned char* output, int length)
+        {
+            while (length >= 255)
+            {
+                *output++ = 255;
+                length -= 255;
+            }
+            *output++ = length;
+            return output;
+        }
+
+        inline unsigned char* WriteSequence(unsigned char* output, const unsigned char* literals, int literalCount, int offset, int matchLength)
+        {
+            int matchCode = matchLength - MinMatch;
+
+            unsigned char* token = output++;
+            *token = (std::min(literalCount, 15) << 4) | (matchLength == 0 ? 0 : std::min(matchCode, 15));
+            if (literalCount >= 15)
+                output = WriteLength(output, literalCount - 15);
+
+            memcpy(output, literals, literalCount);
+            output += literalCount;
+
+            if (matchLength == 0)
+                return output;
+
+            *output++ = offset & 0xff;
+            *output++ = offset >> 8;
+            if (matchCode >= 15)
+                output = WriteLength(output, matchCode - 15);
+            return output;
+        }
+
+        // Destination must have GetMaxCompressedSize bytes
+        inline int Compress(const byte* source, int size, byte* destination)
+        {
+            auto input = (const unsigned char*)source;
+            auto output = (unsigned char*)destination;
+
+            int table[1 << HashBits];
+            std::fill(table, table + (1 << HashBits), -1);
+
+            int anchor = 0;
+            int position = 0;
+            int matchEnd = size - LastLiterals;
+            int limit = size - MatchLimit;
+            while (position < limit)
+            {
+                unsigned int sequence = Read32(input + position);
+                int hash = Hash(sequence);
+                int candidate = table[hash];
+                table[hash] = position;
+
+                if (candidate < 0 || position - candidate > MaxOffset || Read32(input + candidate) != sequence)
+                {
+                    // Data without matches is skipped faster
+                    position += 1 + ((position - anchor) >> 6);
+                    continue;
+                }
+
+                int length = MinMatch;
+                while (position + length < matchEnd && input[candidate + length] == input[position + length])
+                    length++;
+
+                output = WriteSequence(output, input + anchor, position - anchor, position - candidate, length);
+                position += length;
+                anchor = position;
+            }
+
+            output = WriteSequence(output, input + anchor, size - anchor, 0, 0);
+            return output - (unsigned char*)destination;
+        }
+
+        // Fails on malformed data instead of writing out of destination
+        inline bool Decompress(const byte* source, int size, byte* destination, int destinationSize)
+        {
+            auto input = (const unsigned char*)source;
+            auto inputEnd = input + size;
+            auto output = (unsigned char*)destination;
+            auto outputStart = output;
+            auto outputEnd = output + destinationSize;
+
+            while (input < inputEnd)
+            {
+                int token = *input++;
+
+                int literalCount = token >> 4;
+                if (literalCount == 15)
+                {
+                    int value;
+                    do
+                    {
+                        if (input == inputEnd)
+                            return false;
+                        value = *input++;
+                        literalCount += value;
+                    } while (value == 255);
+                }
+
+                if (literalCount > inputEnd - input || literalCount > outputEnd - output)
+                    return false;
+                memcpy(output, input, literalCount);
+                input += literalCount;
+                output += literalCount;
+
+                if (input == inputEnd)
+                    break;
+
+                if (inputEnd - input < 2)
+                    return false;
+                int offset = input[0] | (input[1] << 8);
+                input += 2;
+                if (offset == 0 || offset > output - outputStart)
+                    return false;
+
+                int matchLength = token & 15;
+                if (matchLength == 15)
+                {
+                    int value;
+                    do
+                    {
+                        if (input == inputEnd)
+                            return false;
+                        value = *input++;
+                        matchLength += value;
+                    } while (value == 255);
+                }
+                matchLength += MinMatch;
+
+                if (matchLength > outputEnd - output)
+                    return false;
+
+                // Match can overlap bytes it writes
+                const unsigned char* match = output - offset;
+                if (offset >= matchLength)
+                {
+                    memcpy(output, match, matchLength);
+                }
+                else
+                {
+                    for (int i = 0; i < matchLength; ++i)
+                        output[i] = match[i];
+                }
+                output += matchLength;
+            }
+
+            return output == outputEnd;
+        }
+    }
+
+    // Puts same byte of all elements next to each other, so similar values of column form runs
+    inline void Shuffle(const byte* source, byte* destination, int count, int stride)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            for (int b = 0; b < stride; ++b)
+                destination[b * count + i] = source[i * stride + b];
+        }
+    }
+
+    inline void Unshuffle(const byte* source, byte* destination, int count, int stride)
+    {
+        for (int b = 0; b < stride; ++b)
+        {
+            for (int i = 0; i < count; ++i)
+                destination[i * stride + b] = source[b * count + i];
+        }
+    }
+
+    // Every byte is replaced with difference to previous one, so counters and slowly changing values become constant
+    inline void EncodeDelta(byte* data, int size)
+    {
+        for (int i = size - 1; i > 0; --i)
+            data[i] = (byte)(data[i] - data[i - 1]);
+    }
+
+    inline void DecodeDelta(byte* data, int size)
+    {
+        for (int i = 1; i < size; ++i)
+            data[i] = (byte)(data[i] + data[i - 1]);
+    }
+
+    enum class ColumnEncoding : unsigned char
+    {
+        Raw,
+        ShuffleDeltaLz4,
+    };
+
+    // Column of count elements of stride bytes, encoded independently of other columns. Falls back to raw copy if
+    // column does not compress.
+    inline void EncodeColumn(const byte* data, int count, int stride, std::vector<byte>& result)
+    {
+        int size = count * stride;
+        if (size == 0)
+        {
+            result.assign(1, (byte)ColumnEncoding::Raw);
+            return;
+        }
+
+        std::vector<byte> shuffled(size);
+        Shuffle(data, shuffled.data(), count, stride);
+        EncodeDelta(shuffled.data(), size);
+
+        result.resize(1 + Lz4::GetMaxCompressedSize(size));
+        int compressedSize = Lz4::Compress(shuffled.data(), size, result.data() + 1);
+        if (compressedSize < size)
+        {
+            result[0] = (byte)ColumnEncoding::ShuffleDeltaLz4;
+            result.resize(1 + compressedSize);
+        }
+        else
+        {
+            result[0] = (byte)ColumnEncoding::Raw;
+            result.resize(1 + size);
+            memcpy(result.data() + 1, data, size);
+        }
+    }
+
+    inline bool DecodeColumn(const byte* encoded, int encodedSize, byte* data, int count, int stride)
+    {
+        if (encodedSize < 1)
+            return false;
+
+        int size = count * stride;
+        if (size == 0)
+            return encodedSize == 1;
+
+        switch ((ColumnEncoding)encoded[0])
+        {
+        case ColumnEncoding::Raw:
+            if (encodedSize - 1 != size)
+                return false;
+            memcpy(data, encoded + 1, size);
+            return true;
+
+        case ColumnEncoding::ShuffleDeltaLz4:
+        {
+            std::vector<byte> shuffled(size);
+            if (!Lz4::Decompress(encoded + 1, encodedSize - 1, shuffled.data(), size))
+                return false;
+            DecodeDelta(shuffled.data(), size);
+            Unshuffle(shuffled.data(), data, count, stride);
+            return true;
+        }
+
+        default:
+            return false;
+        }
+    }
+}
@@ -11,6 +11,10 @@ struct is_cwrite : std::bool_constant<false> {};
 template <class T>
 struct is_cwrite<T& avoid_alias> : std::bool_constant<true> {};
 
+// Otherwise const reference would match above as write of const type
+template <class T>
+struct is_cwrite<const T& avoid_alias> : std::bool_constant<false> {};
+
 template <class T>
 struct is_cread : std::bool_constant<false> {};
 
@@ -8,9 +8,12 @@
 #include <map>
 #include <typeinfo>
 #include <typeindex>
+#include <unordered_map>
 #include <stack>
 #include <array>
+#include <cstddef>
 #include <functional>
+#include <exception>
 #include "NodeVision.Core.hpp"
 #include "NodeVision.Profiling.h"
 #include "NodeVision.Collections.hpp"
@@ -29,12 +32,21 @@ namespace NodeVision::Entities
     using namespace Blob;
     using namespace Jobs;
 
-    static std::map<Guid, TypeTree> componentTypeTrees;
-    static std::map<Guid, int> componentTypeIndices;
+    static HashMap<Guid, TypeTree> componentTypeTrees;
+    static HashMap<Guid, int> componentTypeIndices;
     static int typeIndexCounter = 0;
 
     typedef void (*ComponentDispose)(void*);
-    static std::map<Guid, ComponentDispose> componentTypeDisposes;
+    static HashMap<Guid, ComponentDispose> componentTypeDisposes;
+
+    typedef void (*ComponentCopy)(void* destination, const void* source);
+    static HashMap<Guid, ComponentCopy> componentTypeCopies;
+
+    // Bytes of default constructed component, used for fields missing in saved data
+    static HashMap<Guid, std::vector<byte>> componentTypeDefaults;
+
+    // Components whose type tree changed since data was saved. Built while reading layouts, used while reading data.
+    static HashMap<Guid, TypeMigration> componentTypeMigrations;
 
     struct ComponentType
     {
@@ -52,105 +64,148 @@ namespace NodeVision::Entities
             {
                 TypeTree typeTree;
                 stream.Transfer("TypeTree", typeTree);
+                typeTree.Size = Size;
 
                 Dispose = nullptr;
+                Copy = nullptr;
 
-                if (!componentTypeIndices.contains(Guid))
+                if (!componentTypeIndices.Contains(Guid))
                 {
                     TypeIndex = typeIndexCounter++;
                     componentTypeIndices[Guid] = TypeIndex;
 
-                    assert(!componentTypeTrees.contains(Guid));
+                    assert(!componentTypeTrees.Contains(Guid));
                     componentTypeTrees[Guid] = typeTree;
 
                     Dispose = nullptr;
+                    Copy = nullptr;
                 }
                 else
                 {
                     TypeIndex = componentTypeIndices[Guid];
                     Dispose = componentTypeDisposes[Guid];
+                    Copy = componentTypeCopies[Guid];
+
+                    // Data is stored with saved layout, it is converted to current one once it is read
+                    auto& currentTypeTree = componentTypeTrees[Guid];
+                    if (typeTree != currentTypeTree && componentTypeDefaults.Contains(Guid))
+                        componentTypeMigrations[Guid] = TypeMigration(typeTree, currentTypeTree, componentTypeDefaults[Guid]);
+                    else
+                        componentTypeMigrations.Erase(Guid);
+                    Size = currentTypeTree.Size;
                 }
             }
             else
             {
-                assert(componentTypeTrees.contains(Guid));
+                assert(componentTypeTrees.Contains(Guid));
                 stream.Transfer("TypeTree", componentTypeTrees[Guid]);
             }
         }
 
         TypeTree& GetTypeTree() const
         {
-            assert(componentTypeTrees.contains(Guid));
+            assert(componentTypeTrees.Contains(Guid));
             return componentTypeTrees[Guid];
         }
 
+        // Null if saved data has current layout
+        const TypeMigration* GetMigration() const
+        {
+            return componentTypeMigrations.Find(Guid);
+        }
+
         Guid Guid;
         int TypeIndex;
         int Size;
         ComponentDispose Dispose;
+        ComponentCopy Copy; // Null for types that can be copied bitwise
     };
 
     static std::map<std::type_index, ComponentType> componentTypes;
+    static std::mutex componentTypesProtect;
+    static std::mutex componentJobHandlesProtect; // Guards job handles of chunk components
 
 #define typeof(Type) GetComponentType<Type>()
 
+    class EntityManager;
+
+    // Live entity managers, so data loaded before its component type was registered can be converted to current layout
+    static std::vector<EntityManager*> entityManagers;
+    static std::mutex entityManagersProtect;
+
+    static void MigrateLoadedComponents(const ComponentType& componentType, const TypeMigration& migration);
+
+    // Describes layout of persistent component together with bytes of default constructed one
     template<class T>
-    static ComponentType GetComponentType()
+    static void CreateTypeTree(TypeTree& typeTree, std::vector<byte>& defaults)
+    {
+        typeTree.Name = typeid(T).name();
+
+        defaults.resize(sizeof(T));
+        T* dummy = new (defaults.data()) T();
+        TypeTreeStream stream(typeTree, dummy);
+        dummy->Transfer(stream);
+        dummy->~T();
+
+        typeTree.Size = sizeof(T);
+    }
+
+    template<class T>
+    static ComponentType CreateComponentType()
     {
+        thread_lock(componentTypesProtect);
+
         const type_info& type = typeid(T);
 
         if (!componentTypes.contains(type))
         {
             Guid guid;
+            bool loaded = false;
 
             // Check if persistent component type is created
             if constexpr (std::is_base_of<ITest, T>::value)
             {
                 guid = T::Id;
-
-                if (componentTypeIndices.contains(guid))
-                {
-                    assert(componentTypeTrees.contains(guid));
-                    auto componentType = ComponentType();
-                    componentType.TypeIndex = componentTypeIndices[guid];
-                    componentType.Size = componentTypeTrees[guid].Size;
-                    componentType.Guid = guid;
-                    componentType.Dispose = componentTypeDisposes[guid];
-                    componentTypes[type] = componentType;
-                    return componentType;
-                }
+                loaded = componentTypeIndices.Contains(guid);
             }
 
-            // Create component type
+            // Create component type, data loaded before type is registered already has index
             auto componentType = ComponentType();
-            componentType.TypeIndex = typeIndexCounter++;
+            componentType.TypeIndex = loaded ? componentTypeIndices[guid] : typeIndexCounter++;
             componentType.Size = sizeof(T);
             componentType.Guid = guid;
 
+            // Add dispose and copy
+            if constexpr (std::is_base_of<IDisposable, T>::value)
+            {
+                componentType.Dispose = [](void* ptr) { ((T*)ptr)->~T(); };
+                componentType.Copy = [](void* destination, const void* source) { new (destination) T(*(const T*)source); };
+            }
+            else
+            {
+                componentType.Dispose = nullptr;
+                componentType.Copy = nullptr;
+            }
+
             // Create persistent component type
             if constexpr (std::is_base_of<ITest, T>::value)
             {
                 TypeTree typeTree;
-                typeTree.Name = type.name();
+                std::vector<byte> defaults;
+                CreateTypeTree<T>(typeTree, defaults);
 
-                TypeTreeStream stream(typeTree);
-                T dummy;
-                dummy.Transfer(stream);
+                // Loaded data has saved layout, as type was not known yet. It is converted in place now.
+                if (loaded && componentTypeTrees[guid] != typeTree)
+                {
+                    TypeMigration migration(componentTypeTrees[guid], typeTree, defaults);
+                    MigrateLoadedComponents(componentType, migration);
+                }
 
-                typeTree.Size = sizeof(T);
                 componentTypeTrees[guid] = typeTree;
                 componentTypeIndices[guid] = componentType.TypeIndex;
+                componentTypeDefaults[guid] = defaults;
                 componentTypeDisposes[guid] = componentType.Dispose;
-            }
-
-            // Add dispose
-            if constexpr (std::is_base_of<IDisposable, T>::value)
-            {
-                componentType.Dispose = [](void* ptr) { ((T*)ptr)->~T(); };
-            }
-            else
-            {
-                componentType.Dispose = nullptr;
+                componentTypeCopies[guid] = componentType.Copy;
             }
 
             componentTypes[type] = componentType;
@@ -159,6 +214,14 @@ namespace NodeVision::Entities
         return componentTypes[type];
     }
 
+    // Cached per type, so jobs can query component types without touching shared maps
+    template<class T>
+    static ComponentType GetComponentType()
+    {
+        static const ComponentType componentType = CreateComponentType<T>();
+        return componentType;
+    }
+
     struct ArchetypeMask2
     {
         ArchetypeMask2() {}
@@ -298,6 +361,22 @@ namespace NodeVision::Entities
             return true;
         }
 
+        void Enable(const ArchetypeFixedMask& archetypeMask)
+        {
+            for (int i = 0; i < N; ++i)
+                Bits[i] |= archetypeMask.Bits[i];
+        }
+
+        bool Overlaps(const ArchetypeFixedMask& archetypeMask) const
+        {
+            for (int i = 0; i < N; ++i)
+            {
+                if ((Bits[i] & archetypeMask.Bits[i]) != 0)
+                    return true;
+            }
+            return false;
+        }
+
         bool operator==(const ArchetypeFixedMask& other) const
         {
             return memcmp(Bits.data(), other.Bits.data(), N * sizeof(int)) == 0;
@@ -411,6 +490,11 @@ namespace NodeVision::Entities
             if (stream.IsRead())
             {
                 Mask = ArchetypeMask(ComponentTypes);
+
+                // Sizes of migrated components can differ from saved ones
+                Size = Expermetal ? sizeof(Entity) : 0;
+                for (auto& componentType : ComponentTypes)
+                    Size += componentType.Size;
             }
         }
 
@@ -438,10 +522,11 @@ namespace NodeVision::Entities
     class ArchetypeChunk
     {
     public:
-        ArchetypeChunk() : Count(0), Capacity(0) {}
+        ArchetypeChunk() : Count(0), Capacity(0), ChangeVersion(0) {}
         ArchetypeChunk(const EntityArchetype& archetype, int size) :
             Archetype(archetype),
-            Count(0)
+            Count(0),
+            ChangeVersion(0)
         {
             Capacity = size / Archetype.Size;
             Data.resize(size);
@@ -453,6 +538,7 @@ namespace NodeVision::Entities
                 ComponentJobHandles.push_back(jobHandle);
                 ComponentReadHandles.push_back(jobHandle);
             }
+            ComponentChangeVersions.assign(Archetype.ComponentTypes.size(), 0);
         }
 
         int PushBack()
@@ -461,26 +547,33 @@ namespace NodeVision::Entities
             return Count++;
         }
 
-        void RemoveAtSwapBack(int arrayIndex)
+        // Without dispose, row is expected to be moved to other chunk
+        void RemoveAtSwapBack(int arrayIndex, bool dispose = true)
         {
             BlobReferenceScope blobReferenceScope;
+            int lastIndex = Count - 1;
             int archetypeOffset = 0;
             if (Archetype.Expermetal)
+            {
+                auto entities = (Entity*)Data.data();
+                entities[arrayIndex] = entities[lastIndex];
                 archetypeOffset = sizeof(Entity);
+            }
             for (auto& componentType : Archetype.ComponentTypes)
             {
                 int typeSize = componentType.Size;
                 int chunkOffset = Capacity * archetypeOffset;
 
                 char* destination = Data.data() + chunkOffset + (arrayIndex * typeSize);
-                char* source = Data.data() + chunkOffset + ((Count - 1) * typeSize);
+                char* source = Data.data() + chunkOffset + (lastIndex * typeSize);
 
-                if (componentType.Dispose != nullptr)
+                if (dispose && componentType.Dispose != nullptr)
                 {
                     componentType.Dispose(destination);
                 }
 
-                memcpy((void*)destination, (void*)source, typeSize);
+                if (arrayIndex != lastIndex)
+                    memcpy((void*)destination, (void*)source, typeSize);
 
                 archetypeOffset += typeSize;
             }
@@ -612,27 +705,198 @@ namespace NodeVision::Entities
             memcpy(dst, data, componentType.Size);
         }
 
+        // Unlike SetComponentData, copy is constructed into uninitialized row, so types like blob references are counted
+        void CopyComponentData(const ComponentType& componentType, int arrayIndex, const byte* data)
+        {
+            byte* dst = GetComponentData(componentType, arrayIndex);
+            if (componentType.Copy != nullptr)
+                componentType.Copy(dst, data);
+            else
+                memcpy(dst, data, componentType.Size);
+        }
+
         bool IsFull() { return Count == Capacity; }
 
+        bool IsChanged(int version) const
+        {
+            if (ChangeVersion > version)
+                return true;
+            for (int componentVersion : ComponentChangeVersions)
+            {
+                if (componentVersion > version)
+                    return true;
+            }
+            return false;
+        }
+
         template<class Stream>
         void Transfer(Stream& stream)
+        {
+            TransferLayout(stream);
+            TransferData(stream);
+        }
+
+        // Reading layout registers component types, so it can not run concurrently
+        template<class Stream>
+        void TransferLayout(Stream& stream)
         {
             transfer(Archetype);
             transfer(Count);
             transfer(Capacity);
             if (stream.IsRead())
             {
+                JobHandle jobHandle;
+                jobHandle.Index = 0;
+                jobHandle.Version = 0;
+                ComponentJobHandles.assign(Archetype.ComponentTypes.size(), jobHandle);
+                ComponentReadHandles.assign(Archetype.ComponentTypes.size(), jobHandle);
+                ComponentChangeVersions.assign(Archetype.ComponentTypes.size(), 0);
+            }
+        }
+
+        // Touches only memory of this chunk, so chunks can be transferred concurrently
+        template<class Stream>
+        void TransferData(Stream& stream)
+        {
+            // Binary streams store whole chunk memory, so it can be loaded without touching columns
+            if constexpr (requires { stream.TransferPages("Data", Data); })
+            {
+                if (stream.IsCompressed())
+                {
+                    TransferColumns(stream);
+                    return;
+                }
+
+                stream.TransferPages("Data", Data);
+                if (stream.IsRead())
+                    Migrate();
+                assert(Data.size() >= Capacity * Archetype.Size);
+                return;
+            }
+
+            if (stream.IsRead())
                 Data.resize(Capacity * Archetype.Size);
+
+            if (Archetype.Expermetal)
+            {
+                auto& typeTree = GetComponentType<Entity>().GetTypeTree();
+                stream.Transfer(typeTree, (byte*)GetEntities().data, Count);
             }
             for (auto& componentType : Archetype.ComponentTypes)
             {
                 ArraySlice<byte> slice = GetComponents(componentType);
 
+                auto migration = componentType.GetMigration();
+                if (stream.IsRead() && migration != nullptr)
+                {
+                    std::vector<byte> source(Count * migration->Source.Size);
+                    stream.Transfer(migration->Source, source.data(), Count);
+                    migration->Apply(source.data(), slice.data, Count);
+                    continue;
+                }
+
                 auto& typeTree = componentType.GetTypeTree();
                 stream.Transfer(typeTree, slice.data, Count);
             }
         }
 
+        // Compressed streams store used rows of each column, every column is compressed on its own
+        template<class Stream>
+        void TransferColumns(Stream& stream)
+        {
+            if (stream.IsRead())
+            {
+                Data = PageBuffer();
+                Data.resize(Capacity * Archetype.Size);
+            }
+
+            if (Archetype.Expermetal)
+                stream.TransferColumn("Entities", Data.data(), Count, sizeof(Entity));
+            for (auto& componentType : Archetype.ComponentTypes)
+            {
+                byte* column = GetComponents(componentType).data;
+
+                auto migration = componentType.GetMigration();
+                if (stream.IsRead() && migration != nullptr)
+                {
+                    std::vector<byte> source(Count * migration->Source.Size);
+                    stream.TransferColumn("Column", source.data(), Count, migration->Source.Size);
+                    migration->Apply(source.data(), column, Count);
+                    continue;
+                }
+
+                stream.TransferColumn("Column", column, Count, componentType.Size);
+            }
+        }
+
+        // Converts loaded memory from saved layout, unchanged columns are copied as is
+        void Migrate()
+        {
+            bool migrate = false;
+            for (auto& componentType : Archetype.ComponentTypes)
+                migrate |= componentType.GetMigration() != nullptr;
+            if (!migrate)
+                return;
+
+            PageBuffer source = std::move(Data);
+            Data = PageBuffer();
+            Data.resize(Capacity * Archetype.Size);
+
+            int sourceOffset = 0;
+            if (Archetype.Expermetal)
+            {
+                memcpy(Data.data(), source.data(), Count * sizeof(Entity));
+                sourceOffset = sizeof(Entity);
+            }
+            for (auto& componentType : Archetype.ComponentTypes)
+            {
+                const byte* sourceColumn = source.data() + Capacity * sourceOffset;
+                byte* targetColumn = GetComponents(componentType).data;
+
+                auto migration = componentType.GetMigration();
+                if (migration != nullptr)
+                {
+                    migration->Apply(sourceColumn, targetColumn, Count);
+                    sourceOffset += migration->Source.Size;
+                }
+                else
+                {
+                    memcpy(targetColumn, sourceColumn, Count * componentType.Size);
+                    sourceOffset += componentType.Size;
+                }
+            }
+        }
+
+        // Converts column of component that was loaded before its type was registered, capacity stays the same
+        void MigrateComponent(const ComponentType& componentType, const TypeMigration& migration)
+        {
+            EntityArchetype source = Archetype;
+            std::vector<ComponentType> componentTypes = Archetype.ComponentTypes;
+            for (auto& item : componentTypes)
+            {
+                if (item.TypeIndex == componentType.TypeIndex)
+                    item = componentType;
+            }
+            Archetype = EntityArchetype(componentTypes, source.Expermetal);
+
+            PageBuffer sourceData = std::move(Data);
+            Data = PageBuffer();
+            Data.resize(Capacity * Archetype.Size);
+
+            if (Archetype.Expermetal)
+                memcpy(Data.data(), sourceData.data(), Count * sizeof(Entity));
+            for (auto& item : Archetype.ComponentTypes)
+            {
+                const byte* sourceColumn = sourceData.data() + Capacity * source.GetOffset(item);
+                byte* targetColumn = GetComponents(item).data;
+
+                if (item.TypeIndex == componentType.TypeIndex)
+                    migration.Apply(sourceColumn, targetColumn, Count);
+                else
+                    memcpy(targetColumn, sourceColumn, Count * item.Size);
+            }
+        }
+
         bool operator==(const ArchetypeChunk& other) const
         {
             if (Archetype != other.Archetype)
@@ -652,11 +916,13 @@ namespace NodeVision::Entities
         bool operator!=(const ArchetypeChunk& other) const { return !(operator==(other)); }
 
         EntityArchetype Archetype;
-        std::vector<char> Data;
+        PageBuffer Data; // Can use pages of mapped snapshot in place
         std::vector<JobHandle> ComponentJobHandles;
         std::vector<JobHandle> ComponentReadHandles;
         int Count;
         int Capacity;
+        std::vector<int> ComponentChangeVersions; // Written by jobs, so concurrent writers of other components do not race
+        int ChangeVersion; // Version of entity manager when chunk was last written, not saved
     };
 
     struct IComponent {};
@@ -690,6 +956,7 @@ namespace NodeVision::Entities
                 instance.ChunkIndex = chunkIndex;
                 instance.ArrayIndex = arrayIndex;
                 instance.Version++;
+                MarkChanged(entityIndex);
                 return Entity(entityIndex, instance.Version);
             }
             else
@@ -702,6 +969,7 @@ namespace NodeVision::Entities
                 instance.Version = 0;
 
                 Allocated.push_back(instance);
+                MarkChanged(entityIndex);
 
                 return Entity(entityIndex, instance.Version);
             }
@@ -719,6 +987,7 @@ namespace NodeVision::Entities
             {
                 instance.Version++;
                 Free.push(entity.Index);
+                MarkChanged(entity.Index);
             }
         }
 
@@ -738,12 +1007,33 @@ namespace NodeVision::Entities
         {
             assert(IsValid(entity));
             Allocated[entity.Index].ChunkIndex = chunkIndex;
+            MarkChanged(entity.Index);
         }
 
         void SetArrayIndex(Entity entity, int arrayIndex)
         {
             assert(IsValid(entity));
             Allocated[entity.Index].ArrayIndex = arrayIndex;
+            MarkChanged(entity.Index);
+        }
+
+        // Delta snapshots write only instances changed since last ClearChanged
+        void MarkChanged(int entityIndex)
+        {
+            if (entityIndex >= ChangedMask.size())
+                ChangedMask.resize(Allocated.size());
+            if (ChangedMask[entityIndex])
+                return;
+
+            ChangedMask[entityIndex] = true;
+            Changed.push_back(entityIndex);
+        }
+
+        void ClearChanged()
+        {
+            for (int entityIndex : Changed)
+                ChangedMask[entityIndex] = false;
+            Changed.clear();
         }
 
         template<class Stream>
@@ -760,18 +1050,15 @@ namespace NodeVision::Entities
             if (memcmp(Allocated.data(), other.Allocated.data(), Allocated.size() * sizeof(Instance)) != 0)
                 return false;
 
-            if (Free.size() != other.Free.size())
-                return false;
-            if (Free.size() != 0 && memcmp((int*)&Free.top(), (int*)&other.Free.top(), Free.size() * sizeof(int)) != 0)
-                return false;
-
-            return true;
+            return Free == other.Free;
         }
 
         bool operator!=(const EntityIndexer& other) const { return !(operator==(other)); }
 
         std::vector<Instance> Allocated;
         std::stack<int> Free;
+        std::vector<int> Changed;
+        std::vector<bool> ChangedMask;
     };
 
     class EntityCommandBuffer;
@@ -779,8 +1066,19 @@ namespace NodeVision::Entities
     class EntityManager
     {
     public:
+        EntityManager()
+        {
+            thread_lock(entityManagersProtect);
+            entityManagers.push_back(this);
+        }
+
+        EntityManager(const EntityManager&) = delete;
+        EntityManager& operator=(const EntityManager&) = delete;
+
         ~EntityManager()
         {
+            thread_lock(entityManagersProtect);
+            entityManagers.erase(std::find(entityManagers.begin(), entityManagers.end(), this));
         }
 
         bool operator==(const EntityManager& other) const
@@ -806,56 +1104,68 @@ namespace NodeVision::Entities
 
         Entity CreateEntity(const EntityArchetype& archetype)
         {
-            //profile_function;
-
-            int chunkIndex = GetOrCreateChunk(archetype);
-            auto& chunk = Chunks[chunkIndex];
-
-            int arrayIndex = chunk.PushBack();
-            Entity entity = Indexer.CreateEntity(chunkIndex, arrayIndex);
-
-            if (chunk.Archetype.Expermetal)
-            {
-                chunk.GetEntities()[arrayIndex] = entity;
-            }
-            else
-            {
-                SetComponentData(entity, entity);
-            }
-
+            Entity entity;
+            CreateEntities(archetype, &entity, 1);
             return entity;
         }
 
-        void DestroyEntity(Entity entity)
+        void CreateEntities(const EntityArchetype& archetype, Entity* entities, int count)
         {
             profile_function;
 
-            if (!Indexer.IsValid(entity))
-                return;
-
-            int chunkIndex = Indexer.GetChunkIndex(entity);
-            int arrayIndex = Indexer.GetArrayIndex(entity);
+            BeginStructuralChange();
 
+            int chunkIndex = GetOrCreateChunk(archetype);
             auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk);
 
-            // Update entity at swapback
-            int swapBackArrayIndex = chunk.Count - 1;
-            if (arrayIndex != swapBackArrayIndex)
+            for (int i = 0; i < count; ++i)
             {
-                Entity swapBackEntity;// = chunk.GetComponentData<Entity>(swapBackArrayIndex);
+                int arrayIndex = chunk.PushBack();
+                Entity entity = Indexer.CreateEntity(chunkIndex, arrayIndex);
+
                 if (chunk.Archetype.Expermetal)
                 {
-                    swapBackEntity = chunk.GetEntities()[swapBackArrayIndex];
+                    chunk.GetEntities()[arrayIndex] = entity;
                 }
                 else
                 {
-                    swapBackEntity = chunk.GetComponentData<Entity>(swapBackArrayIndex);
+                    chunk.SetComponentData(arrayIndex, entity);
                 }
-                Indexer.SetArrayIndex(swapBackEntity, arrayIndex);
+
+                entities[i] = entity;
             }
-            chunk.RemoveAtSwapBack(arrayIndex);
+        }
+
+        void DestroyEntity(Entity entity)
+        {
+            DestroyEntities(&entity, 1);
+        }
+
+        void DestroyEntities(const Entity* entities, int count)
+        {
+            profile_function;
+
+            BeginStructuralChange();
+
+            int chunkIndex = -1;
+            for (int i = 0; i < count; ++i)
+            {
+                Entity entity = entities[i];
+                if (!Indexer.IsValid(entity))
+                    continue;
+
+                int entityChunkIndex = Indexer.GetChunkIndex(entity);
+                if (entityChunkIndex != chunkIndex)
+                {
+                    RemoveRows(chunkIndex, true);
+                    chunkIndex = entityChunkIndex;
+                }
 
-            Indexer.DestroyEntity(entity);
+                PendingRemoves.push_back(Indexer.GetArrayIndex(entity));
+                Indexer.DestroyEntity(entity);
+            }
+            RemoveRows(chunkIndex, true);
         }
 
         template<class T>
@@ -866,48 +1176,80 @@ namespace NodeVision::Entities
         }
 
         void AddComponentData(Entity entity, const ComponentType& componentType, byte* data)
+        {
+            const byte* source = data;
+            AddComponentData(&entity, &source, 1, componentType);
+        }
+
+        // Entities that already have component only get data set
+        void AddComponentData(const Entity* entities, const byte* const* data, int count, const ComponentType& componentType)
         {
             profile_function;
 
-            if (!Indexer.IsValid(entity))
-                return;
+            BeginStructuralChange();
 
-            int chunkIndex = Indexer.GetChunkIndex(entity);
-            int arrayIndex = Indexer.GetArrayIndex(entity);
+            int sourceChunkIndex = -1;
+            int targetChunkIndex = -1;
+            for (int i = 0; i < count; ++i)
+            {
+                Entity entity = entities[i];
+                if (!Indexer.IsValid(entity))
+                    continue;
+
+                int chunkIndex = Indexer.GetChunkIndex(entity);
+                if (Chunks[chunkIndex].Archetype.Contains(componentType))
+                {
+                    MarkChanged(Chunks[chunkIndex]);
+                    Chunks[chunkIndex].SetComponentData(componentType, Indexer.GetArrayIndex(entity), (byte*)data[i]);
+                    continue;
+                }
+
+                if (chunkIndex != sourceChunkIndex)
+                {
+                    MoveRows(sourceChunkIndex, targetChunkIndex);
+                    sourceChunkIndex = chunkIndex;
+                    targetChunkIndex = GetOrCreateChunkWithComponent(Chunks[chunkIndex].Archetype, componentType);
+                }
+
+                int arrayIndex = AddRowMove(entity, targetChunkIndex);
+                Chunks[targetChunkIndex].SetComponentData(componentType, arrayIndex, (byte*)data[i]);
+            }
+            MoveRows(sourceChunkIndex, targetChunkIndex);
+        }
+
+        // New entity in the same archetype with copy of all components
+        Entity Instantiate(Entity source)
+        {
+            profile_function;
+
+            assert(Indexer.IsValid(source));
 
-            int newChunkIndex = GetOrCreateChunkWithComponent(Chunks[chunkIndex].Archetype, componentType);
+            BeginStructuralChange();
 
-            auto& newChunk = Chunks[newChunkIndex];
-            int newArrayIndex = newChunk.PushBack();
+            int chunkIndex = Indexer.GetChunkIndex(source);
+            int sourceArrayIndex = Indexer.GetArrayIndex(source);
 
             auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk);
+            int arrayIndex = chunk.PushBack();
+            Entity entity = Indexer.CreateEntity(chunkIndex, arrayIndex);
 
+            BlobReferenceScope blobReferenceScope;
             for (const auto& componentType : chunk.Archetype.ComponentTypes)
             {
-                newChunk.SetComponentData(componentType, newArrayIndex, chunk.GetComponentData(componentType, arrayIndex));
+                chunk.CopyComponentData(componentType, arrayIndex, chunk.GetComponentData(componentType, sourceArrayIndex));
             }
 
-            // Update entity at swapback
-            int swapBackArrayIndex = chunk.Count - 1;
-            if (arrayIndex != swapBackArrayIndex)
+            if (chunk.Archetype.Expermetal)
             {
-                Entity swapBackEntity;// = chunk.GetComponentData<Entity>(swapBackArrayIndex);
-                if (chunk.Archetype.Expermetal)
-                {
-                    swapBackEntity = chunk.GetEntities()[swapBackArrayIndex];
-                }
-                else
-                {
-                    swapBackEntity = chunk.GetComponentData<Entity>(swapBackArrayIndex);
-                }
-                Indexer.SetArrayIndex(swapBackEntity, arrayIndex);
+                chunk.GetEntities()[arrayIndex] = entity;
+            }
+            else
+            {
+                SetComponentData(entity, entity);
             }
-            chunk.RemoveAtSwapBack(arrayIndex);
-
-            Indexer.SetChunkIndex(entity, newChunkIndex);
-            Indexer.SetArrayIndex(entity, newArrayIndex);
 
-            newChunk.SetComponentData(componentType, newArrayIndex, data);
+            return entity;
         }
 
         template<class T>
@@ -919,46 +1261,38 @@ namespace NodeVision::Entities
 
         void RemoveComponent(Entity entity, const ComponentType& componentType)
         {
-            profile_function;
+            RemoveComponent(&entity, 1, componentType);
+        }
 
-            if (!Indexer.IsValid(entity))
-                return;
+        void RemoveComponent(const Entity* entities, int count, const ComponentType& componentType)
+        {
+            profile_function;
 
-            int chunkIndex = Indexer.GetChunkIndex(entity);
-            int arrayIndex = Indexer.GetArrayIndex(entity);
+            BeginStructuralChange();
 
-            int newChunkIndex = GetOrCreateChunkWithoutComponent(Chunks[chunkIndex].Archetype, componentType);
+            int sourceChunkIndex = -1;
+            int targetChunkIndex = -1;
+            for (int i = 0; i < count; ++i)
+            {
+                Entity entity = entities[i];
+                if (!Indexer.IsValid(entity))
+                    continue;
 
-            auto& newChunk = Chunks[newChunkIndex];
-            int newArrayIndex = newChunk.PushBack();
+                int chunkIndex = Indexer.GetChunkIndex(entity);
+                if (!Chunks[chunkIndex].Archetype.Contains(componentType))
+                    continue;
 
-            auto& chunk = Chunks[chunkIndex];
+                if (chunkIndex != sourceChunkIndex)
+                {
+                    MoveRows(sourceChunkIndex, targetChunkIndex);
+                    sourceChunkIndex = chunkIndex;
+                    targetChunkIndex = GetOrCreateChunkWithoutComponent(Chunks[chunkIndex].Archetype, componentType);
+                }
 
-            for (const auto& componentType : newChunk.Archetype.ComponentTypes)
-            {
-                newChunk.SetComponentData(componentType, newArrayIndex, chunk.GetComponentData(componentType, arrayIndex));
+                AddRowMove(entity, targetChunkIndex);
             }
-
-            // Update entity at swapback
-            int swapBackArrayIndex = chunk.Count - 1;
-            if (arrayIndex != swapBackArrayIndex)
-            {
-                Entity swapBackEntity;// = chunk.GetComponentData<Entity>(swapBackArrayIndex);
-                if (chunk.Archetype.Expermetal)
-                {
-                    swapBackEntity = chunk.GetEntities()[swapBackArrayIndex];
-                }
-                else
-                {
-                    swapBackEntity = chunk.GetComponentData<Entity>(swapBackArrayIndex);
-                }
-                Indexer.SetArrayIndex(swapBackEntity, arrayIndex);
-            }
-            chunk.RemoveAtSwapBack(arrayIndex);
-
-            Indexer.SetChunkIndex(entity, newChunkIndex);
-            Indexer.SetArrayIndex(entity, newArrayIndex);
-        }
+            MoveRows(sourceChunkIndex, targetChunkIndex);
+        }
 
         template<class T>
         void SetComponentData(Entity entity, const T& data)
@@ -970,10 +1304,25 @@ namespace NodeVision::Entities
             int arrayIndex = Indexer.GetArrayIndex(entity);
 
             auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk, GetComponentType<T>());
 
             chunk.SetComponentData<T>(arrayIndex, data);
         }
 
+        void SetComponentData(Entity entity, const ComponentType& componentType, byte* data)
+        {
+            if (!Indexer.IsValid(entity))
+                return;
+
+            int chunkIndex = Indexer.GetChunkIndex(entity);
+            int arrayIndex = Indexer.GetArrayIndex(entity);
+
+            auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk, componentType);
+
+            chunk.SetComponentData(componentType, arrayIndex, data);
+        }
+
         template<class T>
         T& GetComponentData(Entity entity)
         {
@@ -982,7 +1331,9 @@ namespace NodeVision::Entities
             int chunkIndex = Indexer.GetChunkIndex(entity);
             int arrayIndex = Indexer.GetArrayIndex(entity);
 
+            // Returned reference can be written
             auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk, GetComponentType<T>());
 
             return chunk.GetComponentData<T>(arrayIndex);
         }
@@ -995,10 +1346,38 @@ namespace NodeVision::Entities
             int arrayIndex = Indexer.GetArrayIndex(entity);
 
             auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk, componentType);
 
             return chunk.GetComponentData(componentType, arrayIndex);
         }
 
+        // Incremented by every change of entity layout. Such changes can not run concurrently with jobs.
+        int GetStructuralVersion() const { return StructuralVersion; }
+
+        // Converts chunks holding component loaded with older layout. Must not run concurrently with jobs.
+        void MigrateComponent(const ComponentType& componentType, const TypeMigration& migration)
+        {
+            profile_function;
+
+            for (auto& chunk : Chunks)
+            {
+                if (chunk.Archetype.Contains(componentType))
+                    chunk.MigrateComponent(componentType, migration);
+            }
+        }
+
+        // Called before every change of entity layout, World uses it to complete jobs that could still access chunks
+        void SetStructuralChangeCallback(std::function<void()> callback) { StructuralChangeCallback = callback; }
+
+        // Chunk is written in delta snapshot if it was marked after last snapshot
+        void MarkChanged(ArchetypeChunk& chunk) { chunk.ChangeVersion = ChangeVersion; }
+
+        // Jobs writing component are marked when scheduled
+        void MarkChanged(ArchetypeChunk& chunk, const ComponentType& componentType)
+        {
+            chunk.ComponentChangeVersions[chunk.Archetype.GetIndex(componentType)] = ChangeVersion;
+        }
+
         void GetChunks(const ArchetypeMask& includeMask, std::vector<ArchetypeChunk*>& result)
         {
             profile_function;
@@ -1018,7 +1397,273 @@ namespace NodeVision::Entities
             transfer(Chunks);
         }
 
+        // Layouts are written first, then chunk data encoded in jobs each into its own block. Blocks are written in
+        // chunk order. Snapshot can be read only with Load.
+        void Save(BinaryWriteStream& stream, WorkerManager& workerManager)
+        {
+            profile_function;
+
+            transfername("Version", ChangeVersion);
+            transfer(Indexer);
+            int count = Chunks.size();
+            transfer(count);
+            for (auto& chunk : Chunks)
+                chunk.TransferLayout(stream);
+
+            std::vector<BinaryWriteStream> blocks(count);
+            auto jobHandle = workerManager.ScheduleParallelFor(SaveChunkJob(Chunks.data(), blocks.data(), stream.IsCompressed()), count, 1);
+            workerManager.Complete(jobHandle);
+
+            for (auto& block : blocks)
+            {
+                long long size = block.GetMemory().size();
+                transfername("Size", size);
+            }
+            for (auto& block : blocks)
+                stream.WriteBlock(block.GetMemory());
+
+            ResetChanges(ChangeVersion);
+        }
+
+        // Layouts are read first, then chunk data is decoded in jobs
+        void Load(BinaryReadStream& stream, WorkerManager& workerManager)
+        {
+            profile_function;
+
+            int version;
+            transfername("Version", version);
+            transfer(Indexer);
+            int count;
+            transfer(count);
+            Chunks.clear();
+            Chunks.resize(count);
+            for (auto& chunk : Chunks)
+                chunk.TransferLayout(stream);
+
+            std::vector<long long> sizes(count);
+            for (auto& size : sizes)
+                transfername("Size", size);
+
+            std::vector<BinaryReadStream> blocks;
+            for (auto size : sizes)
+                blocks.push_back(stream.ReadBlock(size));
+
+            auto jobHandle = workerManager.ScheduleParallelFor(LoadChunkJob(Chunks.data(), blocks.data()), count, 1);
+            workerManager.Complete(jobHandle);
+
+            ResetChanges(version);
+        }
+
+        // Writes entities and chunks changed since last Save, Load or SaveDelta. Changed chunks are written whole.
+        void SaveDelta(BinaryWriteStream& stream)
+        {
+            profile_function;
+
+            transfername("BaseVersion", SnapshotVersion);
+            transfername("Version", ChangeVersion);
+
+            int entityCount = Indexer.Allocated.size();
+            transfername("EntityCount", entityCount);
+            transfername("Changed", Indexer.Changed);
+            for (int entityIndex : Indexer.Changed)
+                transfername("Instance", Indexer.Allocated[entityIndex]);
+            transfername("Free", Indexer.Free);
+
+            int count = Chunks.size();
+            transfer(count);
+            std::vector<int> changedChunks;
+            for (int i = 0; i < count; ++i)
+            {
+                if (Chunks[i].IsChanged(SnapshotVersion))
+                    changedChunks.push_back(i);
+            }
+            transfername("ChangedChunks", changedChunks);
+            for (int chunkIndex : changedChunks)
+                transfername("Chunk", Chunks[chunkIndex]);
+
+            ResetChanges(ChangeVersion);
+        }
+
+        // Deltas must be applied in order they were saved, on top of snapshot they were recorded against
+        void LoadDelta(BinaryReadStream& stream)
+        {
+            profile_function;
+
+            int baseVersion;
+            transfername("BaseVersion", baseVersion);
+            assert(baseVersion == SnapshotVersion && "Delta was recorded against other snapshot");
+            int version;
+            transfername("Version", version);
+
+            int entityCount;
+            transfername("EntityCount", entityCount);
+            Indexer.Allocated.resize(entityCount);
+            std::vector<int> changed;
+            transfername("Changed", changed);
+            for (int entityIndex : changed)
+                transfername("Instance", Indexer.Allocated[entityIndex]);
+            transfername("Free", Indexer.Free);
+
+            int count;
+            transfer(count);
+            Chunks.resize(count);
+            std::vector<int> changedChunks;
+            transfername("ChangedChunks", changedChunks);
+            for (int chunkIndex : changedChunks)
+                transfername("Chunk", Chunks[chunkIndex]);
+
+            ResetChanges(version);
+        }
+
     private:
+        void BeginStructuralChange()
+        {
+            if (StructuralChangeCallback)
+                StructuralChangeCallback();
+            StructuralVersion++;
+        }
+
+        // Everything written after this is part of next delta
+        void ResetChanges(int version)
+        {
+            SnapshotVersion = version;
+            ChangeVersion = version + 1;
+            Indexer.ClearChanged();
+        }
+
+        struct SaveChunkJob : IJobParallelFor
+        {
+            SaveChunkJob(ArchetypeChunk* chunks, BinaryWriteStream* blocks, bool compress) :
+                Chunks(chunks),
+                Blocks(blocks),
+                Compress(compress)
+            {
+            }
+
+            virtual void Execute(int index)
+            {
+                Blocks[index].OpenMemory(Compress);
+                Chunks[index].TransferData(Blocks[index]);
+            }
+
+            ArchetypeChunk* Chunks;
+            BinaryWriteStream* Blocks;
+            bool Compress;
+        };
+
+        struct LoadChunkJob : IJobParallelFor
+        {
+            LoadChunkJob(ArchetypeChunk* chunks, BinaryReadStream* blocks) : Chunks(chunks), Blocks(blocks) {}
+
+            virtual void Execute(int index)
+            {
+                Chunks[index].TransferData(Blocks[index]);
+            }
+
+            ArchetypeChunk* Chunks;
+            BinaryReadStream* Blocks;
+        };
+
+        // Rows moved between two chunks. Contiguous rows are merged, so they are copied with one memcpy per column.
+        struct RowMove
+        {
+            int Source;
+            int Target;
+            int Count;
+        };
+
+        Entity GetEntity(ArchetypeChunk& chunk, int arrayIndex)
+        {
+            if (chunk.Archetype.Expermetal)
+                return chunk.GetEntities()[arrayIndex];
+            else
+                return chunk.GetComponentData<Entity>(arrayIndex);
+        }
+
+        // Reserves row in target chunk, data is copied later by MoveRows
+        int AddRowMove(Entity entity, int targetChunkIndex)
+        {
+            auto& targetChunk = Chunks[targetChunkIndex];
+            int sourceArrayIndex = Indexer.GetArrayIndex(entity);
+            int targetArrayIndex = targetChunk.PushBack();
+
+            if (!PendingMoves.empty() &&
+                PendingMoves.back().Source + PendingMoves.back().Count == sourceArrayIndex &&
+                PendingMoves.back().Target + PendingMoves.back().Count == targetArrayIndex)
+            {
+                PendingMoves.back().Count++;
+            }
+            else
+            {
+                PendingMoves.push_back({ sourceArrayIndex, targetArrayIndex, 1 });
+            }
+            PendingRemoves.push_back(sourceArrayIndex);
+
+            if (targetChunk.Archetype.Expermetal)
+                targetChunk.GetEntities()[targetArrayIndex] = entity;
+
+            Indexer.SetChunkIndex(entity, targetChunkIndex);
+            Indexer.SetArrayIndex(entity, targetArrayIndex);
+
+            return targetArrayIndex;
+        }
+
+        void MoveRows(int sourceChunkIndex, int targetChunkIndex)
+        {
+            if (PendingMoves.empty())
+                return;
+
+            auto& sourceChunk = Chunks[sourceChunkIndex];
+            auto& targetChunk = Chunks[targetChunkIndex];
+            MarkChanged(targetChunk);
+
+            for (const auto& componentType : targetChunk.Archetype.ComponentTypes)
+            {
+                if (!sourceChunk.Archetype.Contains(componentType))
+                    continue;
+
+                int size = componentType.Size;
+                byte* source = sourceChunk.GetComponents(componentType).data;
+                byte* target = targetChunk.GetComponents(componentType).data;
+                for (const auto& move : PendingMoves)
+                    memcpy(target + move.Target * size, source + move.Source * size, move.Count * size);
+            }
+            PendingMoves.clear();
+
+            // Components that do not exist in target are dropped
+            BlobReferenceScope blobReferenceScope;
+            for (const auto& componentType : sourceChunk.Archetype.ComponentTypes)
+            {
+                if (componentType.Dispose == nullptr || targetChunk.Archetype.Contains(componentType))
+                    continue;
+
+                for (int arrayIndex : PendingRemoves)
+                    componentType.Dispose(sourceChunk.GetComponentData(componentType, arrayIndex));
+            }
+
+            RemoveRows(sourceChunkIndex, false);
+        }
+
+        // Rows are removed from the highest, so row swapped into removed one is never removed after it
+        void RemoveRows(int chunkIndex, bool dispose)
+        {
+            if (PendingRemoves.empty())
+                return;
+
+            auto& chunk = Chunks[chunkIndex];
+            MarkChanged(chunk);
+
+            std::sort(PendingRemoves.begin(), PendingRemoves.end(), std::greater<int>());
+            for (int arrayIndex : PendingRemoves)
+            {
+                int swapBackArrayIndex = chunk.Count - 1;
+                if (arrayIndex != swapBackArrayIndex)
+                    Indexer.SetArrayIndex(GetEntity(chunk, swapBackArrayIndex), arrayIndex);
+                chunk.RemoveAtSwapBack(arrayIndex, dispose);
+            }
+            PendingRemoves.clear();
+        }
+
         int GetOrCreateChunk(const EntityArchetype& archetype)
         {
             //profile_function;
@@ -1031,6 +1676,7 @@ namespace NodeVision::Entities
 
             int chunkIndex = Chunks.size();
             Chunks.push_back(ArchetypeChunk(archetype, 1 << 16));
+            MarkChanged(Chunks.back());
             return chunkIndex;
         }
 
@@ -1062,10 +1708,11 @@ namespace NodeVision::Entities
             std::vector<ComponentType> componentTypes = archetype.ComponentTypes;
             componentTypes.push_back(componentType);
 
-            auto newArchetype = EntityArchetype(componentTypes);
+            auto newArchetype = EntityArchetype(componentTypes, archetype.Expermetal);
 
             int chunkIndex = Chunks.size();
             Chunks.push_back(ArchetypeChunk(newArchetype, 1 << 16));
+            MarkChanged(Chunks.back());
             return chunkIndex;
         }
 
@@ -1073,7 +1720,7 @@ namespace NodeVision::Entities
         {
             static ArchetypeMask tempMask;
             tempMask = archetype.Mask;
-            tempMask.Enable(componentType);
+            tempMask.Disable(componentType);
 
             for (int i = 0; i < Chunks.size(); ++i)
             {
@@ -1082,121 +1729,506 @@ namespace NodeVision::Entities
             }
 
             std::vector<ComponentType> componentTypes = archetype.ComponentTypes;
-            componentTypes.push_back(componentType);
+            componentTypes.erase(std::remove(componentTypes.begin(), componentTypes.end(), componentType), componentTypes.end());
 
-            auto newArchetype = EntityArchetype(componentTypes);
+            auto newArchetype = EntityArchetype(componentTypes, archetype.Expermetal);
 
             int chunkIndex = Chunks.size();
             Chunks.push_back(ArchetypeChunk(newArchetype, 1 << 16));
+            MarkChanged(Chunks.back());
             return chunkIndex;
         }
 
         EntityIndexer Indexer;
         std::vector<ArchetypeChunk> Chunks;
+        int StructuralVersion = 0;
+        std::function<void()> StructuralChangeCallback;
+        int ChangeVersion = 1;
+        int SnapshotVersion = 0;
+        std::vector<RowMove> PendingMoves;
+        std::vector<int> PendingRemoves;
     };
 
+    static void MigrateLoadedComponents(const ComponentType& componentType, const TypeMigration& migration)
+    {
+        thread_lock(entityManagersProtect);
+        for (auto manager : entityManagers)
+            manager->MigrateComponent(componentType, migration);
+    }
+
+    // Records structural changes and applies them later on main thread. Commands are played back in recording order,
+    // followed by commands of parallel writers ordered by their sort key.
     class EntityCommandBuffer
     {
     public:
-        EntityCommandBuffer(EntityManager& manager) : Manager(manager), Offset(0), Count(0) {}
+        EntityCommandBuffer(EntityManager& manager) :
+            Manager(manager),
+            ParallelStreams(WorkerManager::MaxWorkerCount + 1),
+            PlaceholderCount(0)
+        {}
 
-        template<class C>
-        void AddComponentData(Entity entity, const C& data)
+        // Lets jobs running on different workers record into same buffer without locks. Every worker writes into its own
+        // stream and playback merges them by sort key, so result does not depend on which worker ran what.
+        // Sort key should be unique for job iteration, for example entity index or chunk index combined with row.
+        struct ParallelWriter
         {
-            auto componentType = GetComponentType<C>();
-            Write(entity);
-            Write(componentType);
-            Write(data);
-            Write(sizeof(C));
-            Write(Command::AddComponentData);
-            Count++;
+            ParallelWriter() : Buffer(nullptr) {}
+            ParallelWriter(EntityCommandBuffer* buffer) : Buffer(buffer) {}
+
+            Entity CreateEntity(int sortKey, const EntityArchetype& archetype) const
+            {
+                return Buffer->WriteCreateEntity(GetStream(), sortKey, archetype);
+            }
+
+            Entity Instantiate(int sortKey, Entity prefab) const
+            {
+                return Buffer->WriteInstantiate(GetStream(), sortKey, prefab);
+            }
+
+            void DestroyEntity(int sortKey, Entity entity) const
+            {
+                Buffer->WriteDestroyEntity(GetStream(), sortKey, entity);
+            }
+
+            template<class C>
+            void AddComponentData(int sortKey, Entity entity, const C& data) const
+            {
+                Buffer->WriteComponentCommand(GetStream(), Command::AddComponentData, sortKey, entity, GetComponentType<C>(), (const byte*)&data);
+            }
+
+            template<class C>
+            void SetComponentData(int sortKey, Entity entity, const C& data) const
+            {
+                Buffer->WriteComponentCommand(GetStream(), Command::SetComponentData, sortKey, entity, GetComponentType<C>(), (const byte*)&data);
+            }
+
+            template<class C>
+            void RemoveComponent(int sortKey, Entity entity) const
+            {
+                Buffer->WriteComponentCommand(GetStream(), Command::RemoveComponent, sortKey, entity, GetComponentType<C>(), nullptr);
+            }
+
+        private:
+            PagedStream& GetStream() const
+            {
+                int index = GetWorkerIndex() + 1;
+                assert(index < Buffer->ParallelStreams.size());
+                return Buffer->ParallelStreams[index].Commands;
+            }
+
+            EntityCommandBuffer* Buffer;
+        };
+
+        ParallelWriter AsParallelWriter() { return ParallelWriter(this); }
+
+        // Returns placeholder entity, that can be used by following commands of this buffer until it is played back
+        Entity CreateEntity(const EntityArchetype& archetype)
+        {
+            return WriteCreateEntity(Stream, 0, archetype);
         }
 
-        void AddEntityToArray(std::map<Guid, Entity> value, const Guid& guid, Entity entity)
+        Entity Instantiate(Entity prefab)
         {
+            return WriteInstantiate(Stream, 0, prefab);
+        }
+
+        void DestroyEntity(Entity entity)
+        {
+            WriteDestroyEntity(Stream, 0, entity);
+        }
 
+        template<class C>
+        void AddComponentData(Entity entity, const C& data)
+        {
+            WriteComponentCommand(Stream, Command::AddComponentData, 0, entity, GetComponentType<C>(), (const byte*)&data);
         }
 
-        void CreateEntity(const EntityArchetype& archetype, const byte* data)
+        template<class C>
+        void SetComponentData(Entity entity, const C& data)
         {
+            WriteComponentCommand(Stream, Command::SetComponentData, 0, entity, GetComponentType<C>(), (const byte*)&data);
+        }
 
+        template<class C>
+        void RemoveComponent(Entity entity)
+        {
+            WriteComponentCommand(Stream, Command::RemoveComponent, 0, entity, GetComponentType<C>(), nullptr);
         }
 
+        static bool IsPlaceholder(Entity entity) { return entity.Index < 0; }
+
         void Execute()
         {
-            while (Count != 0)
-            {
-                Command command = Read<Command>();
+            profile_function;
 
-                switch (command)
-                {
-                case Command::AddComponentData:
-                {
-                    auto size = Read<size_t>();
-                    auto data = Read(size);
-                    auto componentType = Read<ComponentType>();
-                    auto entity = Read<Entity>();
-                    Manager.AddComponentData(entity, componentType, data);
-                    Count--;
-                    break;
-                }
+            Placeholders.clear();
+            Placeholders.resize(PlaceholderCount.load(), Entity(-1, -1));
 
-                default:
-                    assert(false);
-                    break;
-                }
+            SortedCommands.clear();
+            GatherCommands(Stream);
+            size_t parallelStart = SortedCommands.size();
+
+            // Streams are gathered in worker order and sort is stable, so commands with same key keep recording order
+            for (auto& stream : ParallelStreams)
+                GatherCommands(stream.Commands);
+
+            std::stable_sort(SortedCommands.begin() + parallelStart, SortedCommands.end(),
+                [](const CommandHeader* a, const CommandHeader* b) { return a->SortKey < b->SortKey; });
+
+            // Consecutive commands of same kind are applied as one batch, so entities moving between same archetypes
+            // are moved together with single chunk lookup
+            for (int i = 0; i < SortedCommands.size();)
+            {
+                int count = GetBatchCount(i);
+                if (count == 1)
+                    ExecuteCommand(SortedCommands[i]);
+                else
+                    ExecuteBatch(SortedCommands.data() + i, count);
+                i += count;
             }
 
-            assert(Offset == 0);
+            // Pages go back to shared pool, so next frame records into same memory
+            Stream.Clear();
+            for (auto& stream : ParallelStreams)
+                stream.Commands.Clear();
+
+            PlaceholderCount = 0;
         }
 
     private:
         enum class Command
         {
+            CreateEntity,
+            Instantiate,
+            DestroyEntity,
             AddComponentData,
+            SetComponentData,
+            RemoveComponent,
         };
 
-        template<class T>
-        void Write(const T& data)
+        // Padded, so workers appending to neighbouring streams do not share cache line
+        struct alignas(64) ParallelStream
+        {
+            PagedStream Commands;
+        };
+
+        struct CommandHeader
+        {
+            Command Command;
+            int Size; // Including header
+            int SortKey;
+        };
+
+        // Aligned, so component types that follow it can be read in place
+        struct alignas(alignof(ComponentType)) CreateEntityCommand
+        {
+            CommandHeader Header;
+            Entity Placeholder;
+            int ComponentCount;
+            bool Expermetal;
+            // Followed by component types
+        };
+
+        struct InstantiateCommand
+        {
+            CommandHeader Header;
+            Entity Placeholder;
+            Entity Prefab;
+        };
+
+        struct EntityCommand
+        {
+            CommandHeader Header;
+            Entity Entity;
+        };
+
+        struct ComponentCommand
+        {
+            CommandHeader Header;
+            Entity Entity;
+            ComponentType ComponentType;
+            // Followed by component data, except for remove
+        };
+
+        Entity CreatePlaceholder()
+        {
+            int index = PlaceholderCount.fetch_add(1);
+            return Entity(-index - 1, 0);
+        }
+
+        Entity WriteCreateEntity(PagedStream& stream, int sortKey, const EntityArchetype& archetype)
+        {
+            int componentCount = archetype.ComponentTypes.size();
+            auto command = (CreateEntityCommand*)Allocate(stream, Command::CreateEntity, sortKey, sizeof(CreateEntityCommand) + componentCount * sizeof(ComponentType));
+            command->Placeholder = CreatePlaceholder();
+            command->ComponentCount = componentCount;
+            command->Expermetal = archetype.Expermetal;
+            memcpy(command + 1, archetype.ComponentTypes.data(), componentCount * sizeof(ComponentType));
+            return command->Placeholder;
+        }
+
+        Entity WriteInstantiate(PagedStream& stream, int sortKey, Entity prefab)
+        {
+            auto command = (InstantiateCommand*)Allocate(stream, Command::Instantiate, sortKey, sizeof(InstantiateCommand));
+            command->Placeholder = CreatePlaceholder();
+            command->Prefab = prefab;
+            return command->Placeholder;
+        }
+
+        void WriteDestroyEntity(PagedStream& stream, int sortKey, Entity entity)
+        {
+            auto command = (EntityCommand*)Allocate(stream, Command::DestroyEntity, sortKey, sizeof(EntityCommand));
+            command->Entity = entity;
+        }
+
+        void WriteComponentCommand(PagedStream& stream, Command type, int sortKey, Entity entity, const ComponentType& componentType, const byte* data)
         {
-            if (Data.size() - Offset <= sizeof(T))
+            int dataSize = data != nullptr ? componentType.Size : 0;
+            auto command = (ComponentCommand*)Allocate(stream, type, sortKey, sizeof(ComponentCommand) + dataSize);
+            command->Entity = entity;
+            command->ComponentType = componentType;
+            if (data != nullptr)
+                memcpy(command + 1, data, dataSize);
+        }
+
+        // Placeholders are resolved to entities created earlier in playback
+        Entity Resolve(Entity entity) const
+        {
+            if (!IsPlaceholder(entity))
+                return entity;
+
+            int index = -entity.Index - 1;
+            assert(index < Placeholders.size());
+            assert(!IsPlaceholder(Placeholders[index]) && "Placeholder is used before its creation is played back");
+            return Placeholders[index];
+        }
+
+        void GatherCommands(const PagedStream& stream)
+        {
+            for (auto page = stream.GetFirstPage(); page != nullptr; page = page->Next)
             {
-                int newSize = std::max(sizeof(T) * 2, Data.size() * 2);
-                Data.resize(newSize);
+                for (int offset = 0; offset < page->Size;)
+                {
+                    auto header = (CommandHeader*)(page->Data() + offset);
+                    SortedCommands.push_back(header);
+                    offset += header->Size;
+                }
+            }
+        }
+
+        // Commands can be batched if they do same structural change, for create it must be into same archetype
+        static bool CanBatch(const CommandHeader* a, const CommandHeader* b)
+        {
+            if (a->Command != b->Command)
+                return false;
+
+            switch (a->Command)
+            {
+            case Command::CreateEntity:
+            {
+                auto commandA = (const CreateEntityCommand*)a;
+                auto commandB = (const CreateEntityCommand*)b;
+                if (commandA->ComponentCount != commandB->ComponentCount || commandA->Expermetal != commandB->Expermetal)
+                    return false;
+
+                auto componentTypesA = (const ComponentType*)(commandA + 1);
+                auto componentTypesB = (const ComponentType*)(commandB + 1);
+                for (int i = 0; i < commandA->ComponentCount; ++i)
+                {
+                    if (componentTypesA[i].TypeIndex != componentTypesB[i].TypeIndex)
+                        return false;
+                }
+                return true;
             }
 
-            memcpy(Data.data() + Offset, (const char*)&data, sizeof(T));
-            Offset += sizeof(T);
+            case Command::DestroyEntity:
+                return true;
+
+            case Command::AddComponentData:
+            case Command::RemoveComponent:
+                return ((const ComponentCommand*)a)->ComponentType.TypeIndex == ((const ComponentCommand*)b)->ComponentType.TypeIndex;
+
+            default:
+                return false;
+            }
         }
 
-        template<class T>
-        T& Read()
+        int GetBatchCount(int start) const
         {
-            Offset -= sizeof(T);
-            T* data = ((T*)(Data.data() + Offset));
-            return *data;
+            int end = start + 1;
+            while (end < SortedCommands.size() && CanBatch(SortedCommands[start], SortedCommands[end]))
+                end++;
+            return end - start;
         }
 
-        byte* Read(int length)
+        void ExecuteBatch(const CommandHeader* const* headers, int count)
         {
-            Offset -= length;
-            byte* data = Data.data() + Offset;
-            return data;
+            BatchEntities.resize(count);
+
+            switch (headers[0]->Command)
+            {
+            case Command::CreateEntity:
+            {
+                auto command = (const CreateEntityCommand*)headers[0];
+                auto componentTypes = (const ComponentType*)(command + 1);
+                EntityArchetype archetype(std::vector<ComponentType>(componentTypes, componentTypes + command->ComponentCount), command->Expermetal);
+                Manager.CreateEntities(archetype, BatchEntities.data(), count);
+                for (int i = 0; i < count; ++i)
+                    Placeholders[-((const CreateEntityCommand*)headers[i])->Placeholder.Index - 1] = BatchEntities[i];
+                break;
+            }
+
+            case Command::DestroyEntity:
+            {
+                for (int i = 0; i < count; ++i)
+                    BatchEntities[i] = Resolve(((const EntityCommand*)headers[i])->Entity);
+                Manager.DestroyEntities(BatchEntities.data(), count);
+                break;
+            }
+
+            case Command::AddComponentData:
+            {
+                BatchData.resize(count);
+                for (int i = 0; i < count; ++i)
+                {
+                    auto command = (const ComponentCommand*)headers[i];
+                    BatchEntities[i] = Resolve(command->Entity);
+                    BatchData[i] = (const byte*)(command + 1);
+                }
+                Manager.AddComponentData(BatchEntities.data(), BatchData.data(), count, ((const ComponentCommand*)headers[0])->ComponentType);
+                break;
+            }
+
+            case Command::RemoveComponent:
+            {
+                for (int i = 0; i < count; ++i)
+                    BatchEntities[i] = Resolve(((const ComponentCommand*)headers[i])->Entity);
+                Manager.RemoveComponent(BatchEntities.data(), count, ((const ComponentCommand*)headers[0])->ComponentType);
+                break;
+            }
+
+            default:
+                assert(false);
+                break;
+            }
+        }
+
+        void ExecuteCommand(const CommandHeader* header)
+        {
+            switch (header->Command)
+            {
+            case Command::CreateEntity:
+            {
+                auto command = (const CreateEntityCommand*)header;
+                auto componentTypes = (const ComponentType*)(command + 1);
+                EntityArchetype archetype(std::vector<ComponentType>(componentTypes, componentTypes + command->ComponentCount), command->Expermetal);
+                Placeholders[-command->Placeholder.Index - 1] = Manager.CreateEntity(archetype);
+                break;
+            }
+
+            case Command::Instantiate:
+            {
+                auto command = (const InstantiateCommand*)header;
+                Placeholders[-command->Placeholder.Index - 1] = Manager.Instantiate(Resolve(command->Prefab));
+                break;
+            }
+
+            case Command::DestroyEntity:
+            {
+                auto command = (const EntityCommand*)header;
+                Manager.DestroyEntity(Resolve(command->Entity));
+                break;
+            }
+
+            case Command::AddComponentData:
+            {
+                auto command = (const ComponentCommand*)header;
+                Manager.AddComponentData(Resolve(command->Entity), command->ComponentType, (byte*)(command + 1));
+                break;
+            }
+
+            case Command::SetComponentData:
+            {
+                auto command = (const ComponentCommand*)header;
+                Manager.SetComponentData(Resolve(command->Entity), command->ComponentType, (byte*)(command + 1));
+                break;
+            }
+
+            case Command::RemoveComponent:
+            {
+                auto command = (const ComponentCommand*)header;
+                Manager.RemoveComponent(Resolve(command->Entity), command->ComponentType);
+                break;
+            }
+
+            default:
+                assert(false);
+                break;
+            }
+        }
+
+        // Commands are kept aligned and never span pages, so they can be read in place
+        static byte* Allocate(PagedStream& stream, Command command, int sortKey, int size)
+        {
+            size = (size + alignof(std::max_align_t) - 1) & ~(int)(alignof(std::max_align_t) - 1);
+
+            auto header = (CommandHeader*)stream.Allocate(size);
+            header->Command = command;
+            header->Size = size;
+            header->SortKey = sortKey;
+            return (byte*)header;
         }
 
         EntityManager& Manager;
-        std::vector<byte> Data;
-        int Offset;
-        int Count;
+        PagedStream Stream;
+        std::vector<ParallelStream> ParallelStreams; // Indexed by worker index + 1, first one is for non worker threads
+        std::vector<const CommandHeader*> SortedCommands; // Main stream commands followed by sorted parallel ones
+        std::vector<Entity> BatchEntities;
+        std::vector<const byte*> BatchData;
+        std::atomic<int> PlaceholderCount;
+        std::vector<Entity> Placeholders; // Indexed by placeholder, filled during playback
+    };
+
+    // Component types system reads and writes. Systems without conflicting access are updated concurrently by World.
+    struct SystemAccess
+    {
+        SystemAccess() : Declared(false) {}
+
+        template<class T>
+        void Add(bool write)
+        {
+            if (write)
+                Write.Enable(GetComponentType<T>());
+            else
+                Read.Enable(GetComponentType<T>());
+        }
+
+        void Add(const SystemAccess& other)
+        {
+            Read.Enable(other.Read);
+            Write.Enable(other.Write);
+        }
+
+        bool Conflicts(const SystemAccess& other) const
+        {
+            return Write.Overlaps(other.Write) || Write.Overlaps(other.Read) || Read.Overlaps(other.Write);
+        }
+
+        ArchetypeMask Read;
+        ArchetypeMask Write;
+        bool Declared; // Set in OnCreate, otherwise it is inferred from ForEach calls
+        std::vector<JobHandle> ScheduledJobs; // Jobs scheduled by system in current update, only used by recorded access
+        std::vector<JobHandle> Dependencies; // Jobs scheduled by system in current update also wait for these, only used by recorded access
     };
 
     template<typename TF>
     struct ForEachLambdaJob : IJob
     {
-        ForEachLambdaJob(EntityManager* manager, WorkerManager* workerManager, ArchetypeMask& includeMask, TF func) :
+        ForEachLambdaJob(EntityManager* manager, WorkerManager* workerManager, ArchetypeMask& includeMask, SystemAccess* access, TF func) :
             Manager(manager),
             WorkerManager(workerManager),
             IncludeMask(includeMask),
+            Access(access),
             Func(func)
         {
         }
@@ -1205,112 +2237,102 @@ namespace NodeVision::Entities
         {
             profile_function;
 
-            static_assert(lambda_traits<TF>::arg_count <= 3,
-                "ForEach supports 3 arguments maximum");
+            RecordAccess();
 
-            if constexpr (lambda_traits<TF>::arg_count >= 1 && !std::is_same<Entity, lambda_traits<TF>::arg0_raw_type>::value)
+            if (WorkerManager != nullptr && Access != nullptr)
             {
-                static_assert(lambda_traits<TF>::arg0_cwrite_type::value || lambda_traits<TF>::arg0_cread_type::value,
-                    "For each requires type to be declared with cwrite(Type) or cread(Type)");
-                IncludeMask.Enable(GetComponentType<lambda_traits<TF>::arg0_type>());
+                for (auto& dependency : Access->Dependencies)
+                    WorkerManager->Complete(dependency);
             }
-            if constexpr (lambda_traits<TF>::arg_count >= 2)
-            {
-                static_assert(lambda_traits<TF>::arg1_cwrite_type::value || lambda_traits<TF>::arg1_cread_type::value,
-                    "For each requires type to be declared with cwrite(Type) or cread(Type)");
-                IncludeMask.Enable(GetComponentType<lambda_traits<TF>::arg1_type>());
-            }
-            if constexpr (lambda_traits<TF>::arg_count >= 3)
+
+            // Handles are copied under lock and completed after it, as jobs being completed can schedule too
+            std::vector<JobHandle> dependencies;
             {
-                static_assert(lambda_traits<TF>::arg2_cwrite_type::value || lambda_traits<TF>::arg2_cread_type::value,
-                    "For each requires type to be declared with cwrite(Type) or cread(Type)");
-                IncludeMask.Enable(GetComponentType<lambda_traits<TF>::arg2_type>());
+                thread_lock(componentJobHandlesProtect);
+                GatherComponentArrays(dependencies);
             }
 
-            static std::vector<ArchetypeChunk*> chunks;
+            if (WorkerManager != nullptr)
             {
-                profile_name(GetChunk);
-                chunks.clear();
-                Manager->GetChunks(IncludeMask, chunks);
-                Count = chunks.size();
+                for (auto& dependency : dependencies)
+                    WorkerManager->Complete(dependency);
             }
 
-            assert(lambda_traits<TF>::arg_count * Count <= 50);
+            Execute();
+        }
 
-            int count = 0;
-            for (auto chunk : chunks)
+        JobHandle Schedule(JobPriority priority = JobPriority::Normal)
+        {
+            profile_function;
+            assert(WorkerManager != nullptr);
+
+            std::vector<JobHandle> dependencies;
+            JobHandle handle;
             {
-                if constexpr (lambda_traits<TF>::arg_count >= 1)
+                // Queries can be scheduled from any thread, so handles of chunk are read and replaced as single step.
+                // Readers are combined, as writer has to wait for all of them.
+                thread_lock(componentJobHandlesProtect);
+
+                GatherComponentArrays(dependencies);
+                if (Access != nullptr)
+                    dependencies.insert(dependencies.end(), Access->Dependencies.begin(), Access->Dependencies.end());
+
+                handle = WorkerManager->ScheduleWithPriority(priority, *this, dependencies);
+
+                ReaderCombine readers;
+                int count = 0;
+                for (int i = 0; i < Count; ++i)
                 {
-                    if constexpr (std::is_same<Entity, lambda_traits<TF>::arg0_raw_type>::value)
-                    {
-                        auto entities = (ComponentArraySlice<byte>&) chunk->GetEntitiesForJob();
-                        ComponentArrays[count++] = entities;
-                    }
-                    else if constexpr (lambda_traits<TF>::arg0_cwrite_type::value)
+                    if constexpr (lambda_traits<TF>::arg_count >= 1)
                     {
-                        auto components = (ComponentArraySlice<byte>&) chunk->GetComponentsForJob< lambda_traits<TF>::arg0_type >();
-                        ComponentArrays[count++] = components;
-                        if (WorkerManager != nullptr)
+                        if constexpr (lambda_traits<TF>::arg0_cwrite_type::value)
                         {
-                            WorkerManager->Complete(*components.Handle);
-                            WorkerManager->Complete(*components.ReadOHandle);
+                            *ComponentArrays[count].Handle = handle;
                         }
-                    }
-                    else
-                    {
-                        auto components = (ComponentArraySlice<byte>&) chunk->GetComponentsForJob< lambda_traits<TF>::arg0_type >();
-                        ComponentArrays[count++] = components;
-                        if (WorkerManager != nullptr)
-                            WorkerManager->Complete(*components.Handle);
-                    }
-                }
-                if constexpr (lambda_traits<TF>::arg_count >= 2)
-                {
-                    auto components = (ComponentArraySlice<byte>&) chunk->GetComponentsForJob< lambda_traits<TF>::arg1_type >();
-                    ComponentArrays[count++] = components;
-                    if constexpr (lambda_traits<TF>::arg1_cwrite_type::value)
-                    {
-                        if (WorkerManager != nullptr)
+                        else if constexpr (lambda_traits<TF>::arg0_cread_type::value)
                         {
-                            WorkerManager->Complete(*components.Handle);
-                            WorkerManager->Complete(*components.ReadOHandle);
+                            AddReader(ComponentArrays[count].ReadOHandle, handle, readers);
                         }
+                        count++;
                     }
-                    else
-                    {
-                        if (WorkerManager != nullptr)
-                            WorkerManager->Complete(*components.Handle);
-                    }
-                }
-                if constexpr (lambda_traits<TF>::arg_count >= 3)
-                {
-                    auto components = (ComponentArraySlice<byte>&) chunk->GetComponentsForJob< lambda_traits<TF>::arg2_type >();
-                    ComponentArrays[count++] = components;
-                    if constexpr (lambda_traits<TF>::arg2_cwrite_type::value)
+                    if constexpr (lambda_traits<TF>::arg_count >= 2)
                     {
-                        if (WorkerManager != nullptr)
+                        if constexpr (lambda_traits<TF>::arg1_cwrite_type::value)
+                        {
+                            *ComponentArrays[count].Handle = handle;
+                        }
+                        else
                         {
-                            WorkerManager->Complete(*components.Handle);
-                            WorkerManager->Complete(*components.ReadOHandle);
+                            AddReader(ComponentArrays[count].ReadOHandle, handle, readers);
                         }
+                        count++;
                     }
-                    else
+                    if constexpr (lambda_traits<TF>::arg_count >= 3)
                     {
-                        if (WorkerManager != nullptr)
-                            WorkerManager->Complete(*components.Handle);
+                        if constexpr (lambda_traits<TF>::arg2_cwrite_type::value)
+                        {
+                            *ComponentArrays[count].Handle = handle;
+                        }
+                        else
+                        {
+                            AddReader(ComponentArrays[count].ReadOHandle, handle, readers);
+                        }
+                        count++;
                     }
                 }
             }
 
-            Execute();
+            RecordAccess();
+            if (Access != nullptr)
+                Access->ScheduledJobs.push_back(handle);
+
+            return handle;
         }
 
-        JobHandle Schedule()
+    private:
+        // Fills component arrays of matching chunks and collects handles of jobs that job has to wait for
+        void GatherComponentArrays(std::vector<JobHandle>& dependencies)
         {
-            profile_function;
-            assert(WorkerManager != nullptr);
-
             static_assert(lambda_traits<TF>::arg_count <= 3,
                 "ForEach supports 3 arguments maximum");
 
@@ -1333,22 +2355,15 @@ namespace NodeVision::Entities
                 IncludeMask.Enable(GetComponentType<lambda_traits<TF>::arg2_type>());
             }
 
-            static std::vector<ArchetypeChunk*> chunks;
+            std::vector<ArchetypeChunk*> chunks;
             {
                 profile_name(GetChunk);
-                chunks.clear();
                 Manager->GetChunks(IncludeMask, chunks);
                 Count = chunks.size();
             }
 
             assert(lambda_traits<TF>::arg_count * Count <= 50);
 
-            static std::vector<JobHandle> dependencies;
-            {
-                profile_name(DependencyClear);
-                dependencies.clear();
-            }
-
             int count = 0;
             for (auto chunk : chunks)
             {
@@ -1363,6 +2378,7 @@ namespace NodeVision::Entities
                     {
                         auto components = (ComponentArraySlice<byte>&) chunk->GetComponentsForJob< lambda_traits<TF>::arg0_type >();
                         ComponentArrays[count++] = components;
+                        Manager->MarkChanged(*chunk, GetComponentType<lambda_traits<TF>::arg0_type>());
                         dependencies.push_back(*components.Handle);
                         dependencies.push_back(*components.ReadOHandle);
                     }
@@ -1379,6 +2395,7 @@ namespace NodeVision::Entities
                     ComponentArrays[count++] = components;
                     if constexpr (lambda_traits<TF>::arg1_cwrite_type::value)
                     {
+                        Manager->MarkChanged(*chunk, GetComponentType<lambda_traits<TF>::arg1_type>());
                         dependencies.push_back(*components.Handle);
                         dependencies.push_back(*components.ReadOHandle);
                     }
@@ -1393,6 +2410,7 @@ namespace NodeVision::Entities
                     ComponentArrays[count++] = components;
                     if constexpr (lambda_traits<TF>::arg2_cwrite_type::value)
                     {
+                        Manager->MarkChanged(*chunk, GetComponentType<lambda_traits<TF>::arg2_type>());
                         dependencies.push_back(*components.Handle);
                         dependencies.push_back(*components.ReadOHandle);
                     }
@@ -1402,54 +2420,43 @@ namespace NodeVision::Entities
                     }
                 }
             }
+        }
 
-            JobHandle handle = WorkerManager->Schedule(*this, dependencies);
+        // Chunks of the same query usually share previous reader, so its combined handle is reused
+        struct ReaderCombine
+        {
+            JobHandle Previous = { 0, 0 };
+            JobHandle Combined = { 0, 0 };
+        };
 
-            count = 0;
-            for (int i = 0; i < Count; ++i)
+        void AddReader(JobHandle* readHandle, JobHandle handle, ReaderCombine& readers)
+        {
+            if (WorkerManager->IsCompleted(*readHandle))
             {
-                if constexpr (lambda_traits<TF>::arg_count >= 1)
-                {
-                    if constexpr (lambda_traits<TF>::arg0_cwrite_type::value)
-                    {
-                        *ComponentArrays[count].Handle = handle;
-                    }
-                    else if constexpr (lambda_traits<TF>::arg0_cread_type::value)
-                    {
-                        *ComponentArrays[count].ReadOHandle = handle;
-                    }
-                    count++;
-                }
-                if constexpr (lambda_traits<TF>::arg_count >= 2)
-                {
-                    if constexpr (lambda_traits<TF>::arg1_cwrite_type::value)
-                    {
-                        *ComponentArrays[count].Handle = handle;
-                    }
-                    else
-                    {
-                        *ComponentArrays[count].ReadOHandle = handle;
-                    }
-                    count++;
-                }
-                if constexpr (lambda_traits<TF>::arg_count >= 3)
-                {
-                    if constexpr (lambda_traits<TF>::arg2_cwrite_type::value)
-                    {
-                        *ComponentArrays[count].Handle = handle;
-                    }
-                    else
-                    {
-                        *ComponentArrays[count].ReadOHandle = handle;
-                    }
-                    count++;
-                }
+                *readHandle = handle;
+                return;
             }
 
-            return handle;
+            if (readers.Previous.Index != readHandle->Index || readers.Previous.Version != readHandle->Version)
+            {
+                readers.Previous = *readHandle;
+                readers.Combined = WorkerManager->Combine(*readHandle, handle);
+            }
+            *readHandle = readers.Combined;
         }
 
-    private:
+        void RecordAccess()
+        {
+            if (Access == nullptr)
+                return;
+
+            if constexpr (lambda_traits<TF>::arg_count >= 1 && !std::is_same<Entity, lambda_traits<TF>::arg0_raw_type>::value)
+                Access->Add<lambda_traits<TF>::arg0_type>(lambda_traits<TF>::arg0_cwrite_type::value);
+            if constexpr (lambda_traits<TF>::arg_count >= 2)
+                Access->Add<lambda_traits<TF>::arg1_type>(lambda_traits<TF>::arg1_cwrite_type::value);
+            if constexpr (lambda_traits<TF>::arg_count >= 3)
+                Access->Add<lambda_traits<TF>::arg2_type>(lambda_traits<TF>::arg2_cwrite_type::value);
+        }
 
         virtual void Execute()
         {
@@ -1487,6 +2494,7 @@ namespace NodeVision::Entities
 
         EntityManager* Manager;
         ArchetypeMask& IncludeMask;
+        SystemAccess* Access;
 
         WorkerManager* WorkerManager;
         TF Func;
@@ -1497,10 +2505,13 @@ namespace NodeVision::Entities
 
     struct Query
     {
-        Query(EntityManager* manager) : Manager(manager), WorkerManager(nullptr)
+        Query(EntityManager* manager) : Manager(manager), WorkerManager(nullptr), Access(nullptr)
+        {
+        }
+        Query(EntityManager* manager, WorkerManager* workerManager) : Manager(manager), WorkerManager(workerManager), Access(nullptr)
         {
         }
-        Query(EntityManager* manager, WorkerManager* workerManager) : Manager(manager), WorkerManager(workerManager)
+        Query(EntityManager* manager, WorkerManager* workerManager, SystemAccess* access) : Manager(manager), WorkerManager(workerManager), Access(access)
         {
         }
 
@@ -1508,7 +2519,7 @@ namespace NodeVision::Entities
         ForEachLambdaJob<TF> ForEach(TF&& func)
         {
             profile_function;
-            return ForEachLambdaJob<TF>(Manager, WorkerManager, IncludeMask, func);
+            return ForEachLambdaJob<TF>(Manager, WorkerManager, IncludeMask, Access, func);
         }
 
         int Count()
@@ -1544,11 +2555,13 @@ namespace NodeVision::Entities
 
         EntityManager* Manager;
         WorkerManager* WorkerManager;
+        SystemAccess* Access; // Records component access of system running the query
         ArchetypeMask IncludeMask;
         ArchetypeMask ExcludeMask;
     };
 
     class World;
+    class SystemGroup;
 
     class System
     {
@@ -1556,22 +2569,207 @@ namespace NodeVision::Entities
         System(World* world, EntityManager& manager, WorkerManager* workerManager) :
             World(world),
             Manager(manager), 
-            WorkerManager(workerManager)
+            WorkerManager(workerManager),
+            Group(nullptr),
+            DeltaTime(0)
         {}
 
+        virtual ~System() {}
+
     public:
         virtual void OnCreate() {}
         virtual void OnUpdate() = 0;
         virtual void OnDestroy() {}
 
     protected:
-        Query Entities() const { return Query(&Manager, WorkerManager); }
+        Query Entities() { return Query(&Manager, WorkerManager, &RecordedAccess); }
         WorkerManager& GetWorkerManager() const { return *WorkerManager; }
 
+        // Time step of current update, inside fixed step group it is the fixed step
+        float GetDeltaTime() const { return DeltaTime; }
+
+        // Ordering constraints are declared in OnCreate and only apply to systems in the same group
+        template<class S>
+        void UpdateBefore()
+        {
+            UpdateBeforeTypes.push_back(typeid(S));
+        }
+
+        template<class S>
+        void UpdateAfter()
+        {
+            UpdateAfterTypes.push_back(typeid(S));
+        }
+
+        // Places system into group instead of the root group, must be called in OnCreate
+        template<class G>
+        void UpdateInGroup();
+
+        // Declared access lets World schedule jobs of system right from the first frame, waiting only for systems
+        // with conflicting access. Such system must declare every component it touches outside of ForEach.
+        template<class T>
+        void ReadsComponent()
+        {
+            Access.Add<T>(false);
+            Access.Declared = true;
+        }
+
+        template<class T>
+        void WritesComponent()
+        {
+            Access.Add<T>(true);
+            Access.Declared = true;
+        }
+
     protected:
         World* World;
         EntityManager& Manager;
         WorkerManager* WorkerManager;
+
+    private:
+        friend class World;
+        friend class SystemGroup;
+
+        SystemGroup* Group;
+        std::vector<std::type_index> UpdateBeforeTypes;
+        std::vector<std::type_index> UpdateAfterTypes;
+        float DeltaTime;
+
+        SystemAccess Access; // Used for scheduling, only changed on main thread
+        SystemAccess RecordedAccess; // Collected by ForEach during update, merged into access once frame completes
+    };
+
+    // Container of systems. Children are ordered by their UpdateBefore/UpdateAfter constraints,
+    // ties keep creation order. World updates children of group in place of the group itself.
+    class SystemGroup : public System
+    {
+    public:
+        using System::System;
+
+        virtual void OnUpdate() {}
+
+        // How many times children are updated this frame and with what time step
+        virtual int GetIterationCount(float deltaTime, float& iterationDeltaTime)
+        {
+            iterationDeltaTime = deltaTime;
+            return 1;
+        }
+
+        const std::vector<System*>& GetSystems() const { return Systems; }
+
+    private:
+        friend class World;
+
+        void AddSystem(System* system)
+        {
+            Systems.push_back(system);
+            Sorted = false;
+        }
+
+        // Kahn's algorithm, picking earliest created ready system to keep order stable
+        void SortSystems()
+        {
+            profile_function;
+
+            if (Sorted)
+                return;
+            Sorted = true;
+
+            int count = Systems.size();
+            std::unordered_map<std::type_index, int> indices;
+            for (int i = 0; i < count; ++i)
+                indices[typeid(*Systems[i])] = i;
+
+            std::vector<std::vector<int>> edges(count);
+            std::vector<int> incoming(count, 0);
+            for (int i = 0; i < count; ++i)
+            {
+                for (auto& type : Systems[i]->UpdateBeforeTypes)
+                {
+                    auto before = indices.find(type);
+                    if (before == indices.end())
+                        continue;
+                    edges[i].push_back(before->second);
+                    incoming[before->second]++;
+                }
+                for (auto& type : Systems[i]->UpdateAfterTypes)
+                {
+                    auto after = indices.find(type);
+                    if (after == indices.end())
+                        continue;
+                    edges[after->second].push_back(i);
+                    incoming[i]++;
+                }
+            }
+
+            std::vector<System*> sorted;
+            sorted.reserve(count);
+            std::vector<bool> done(count, false);
+            while (sorted.size() < count)
+            {
+                int next = -1;
+                for (int i = 0; i < count; ++i)
+                {
+                    if (!done[i] && incoming[i] == 0)
+                    {
+                        next = i;
+                        break;
+                    }
+                }
+                assert(next != -1 && "Cycle in system update order");
+                if (next == -1)
+                    break;
+
+                done[next] = true;
+                sorted.push_back(Systems[next]);
+                for (auto edge : edges[next])
+                    incoming[edge]--;
+            }
+
+            Systems = sorted;
+        }
+
+    private:
+        std::vector<System*> Systems;
+        bool Sorted = true;
+    };
+
+    // Updates children with constant time step, running as many iterations as needed to catch up with
+    // elapsed time. Iterations are capped, so slow frame does not make next frames even slower.
+    class FixedStepSystemGroup : public SystemGroup
+    {
+    public:
+        using SystemGroup::SystemGroup;
+
+        virtual int GetIterationCount(float deltaTime, float& iterationDeltaTime)
+        {
+            iterationDeltaTime = Timestep;
+
+            Accumulator += deltaTime;
+            int count = (int)(Accumulator / Timestep);
+            if (count > MaxIterations)
+            {
+                count = MaxIterations;
+                Accumulator = 0;
+            }
+            else
+            {
+                Accumulator -= count * Timestep;
+            }
+            return count;
+        }
+
+        void SetTimestep(float timestep) { assert(timestep > 0); Timestep = timestep; }
+        float GetTimestep() const { return Timestep; }
+        void SetMaxIterations(int maxIterations) { assert(maxIterations > 0); MaxIterations = maxIterations; }
+
+        // Fraction of step left in accumulator, used for interpolating between simulation states
+        float GetInterpolation() const { return Accumulator / Timestep; }
+
+    private:
+        float Timestep = 1.0f / 60.0f;
+        int MaxIterations = 4;
+        float Accumulator = 0;
     };
 
     class World
@@ -1582,6 +2780,8 @@ namespace NodeVision::Entities
         {
             Manager = new EntityManager();
             m_BlobManager = new BlobManager();
+            Root = new SystemGroup(this, *Manager, Worker);
+            LastUpdateTime = std::chrono::steady_clock::now();
         }
 
         World(WorkerManager* workerManager) :
@@ -1589,6 +2789,8 @@ namespace NodeVision::Entities
         {
             Manager = new EntityManager();
             m_BlobManager = new BlobManager();
+            Root = new SystemGroup(this, *Manager, Worker);
+            LastUpdateTime = std::chrono::steady_clock::now();
         }
 
         ~World()
@@ -1598,19 +2800,45 @@ namespace NodeVision::Entities
                 system->OnDestroy();
             }
 
+            for (auto system : Systems)
+            {
+                delete system;
+            }
+
+            delete Root;
             delete Manager;
             delete m_BlobManager;
         }
 
+        // Uses time elapsed since previous update, or since world was created for the first update
         void Update()
+        {
+            auto now = std::chrono::steady_clock::now();
+            Update(std::chrono::duration<float>(now - LastUpdateTime).count());
+        }
+
+        void Update(float deltaTime)
         {
             profile_function;
 
+            LastUpdateTime = std::chrono::steady_clock::now();
+
             SetBlobManager(m_BlobManager);
 
-            for (auto system : Systems)
+            UpdateList.clear();
+            AddToUpdateList(Root, deltaTime);
+
+            if (Worker == nullptr)
             {
-                system->OnUpdate();
+                for (auto& entry : UpdateList)
+                {
+                    entry.System->DeltaTime = entry.DeltaTime;
+                    entry.System->OnUpdate();
+                }
+            }
+            else
+            {
+                UpdateConcurrent();
             }
 
             SetBlobManager(nullptr);
@@ -1620,30 +2848,141 @@ namespace NodeVision::Entities
         S& GetOrCreateSystem()
         {
             profile_function;
-            for (auto system : Systems)
-            {
-                if (typeid(system) == typeid(S))
-                    return *((S*)system);
-            }
+
+            auto found = SystemsByType.find(typeid(S));
+            if (found != SystemsByType.end())
+                return *((S*)found->second);
 
             auto system = new S(this, *Manager, Worker);
             Systems.push_back(system);
+            SystemsByType[typeid(S)] = system;
 
             SetBlobManager(m_BlobManager);
 
-            profile_name(OnCreate);
-            system->OnCreate();
+            {
+                profile_name(OnCreate);
+                system->OnCreate();
+            }
+
+            auto group = system->Group != nullptr ? system->Group : Root;
+            assert(group != (System*)system);
+            group->AddSystem(system);
 
             return *system;
         }
 
+        template<class S>
+        S* GetExistingSystem() const
+        {
+            auto found = SystemsByType.find(typeid(S));
+            return found != SystemsByType.end() ? (S*)found->second : nullptr;
+        }
+
         EntityManager& GetManager() const { return *Manager; }
 
+    private:
+        struct UpdateEntry
+        {
+            System* System;
+            float DeltaTime;
+        };
+
+        // Flattens group hierarchy into systems updated this frame, fixed step groups can add their children several times
+        void AddToUpdateList(SystemGroup* group, float deltaTime)
+        {
+            group->SortSystems();
+
+            float iterationDeltaTime;
+            int iterationCount = group->GetIterationCount(deltaTime, iterationDeltaTime);
+            for (int i = 0; i < iterationCount; ++i)
+            {
+                for (auto system : group->Systems)
+                {
+                    if (auto childGroup = dynamic_cast<SystemGroup*>(system))
+                        AddToUpdateList(childGroup, iterationDeltaTime);
+                    else
+                        UpdateList.push_back({ system, iterationDeltaTime });
+                }
+            }
+        }
+
+        // Builds dependency graph of systems for this frame. Bodies run on main thread in update order, as blob references
+        // and completing jobs inside OnUpdate are main thread only. Jobs a system schedules depend only on jobs of earlier
+        // systems with conflicting access, so frame takes as long as its critical path.
+        void UpdateConcurrent()
+        {
+            profile_function;
+
+            SystemHandles.resize(UpdateList.size());
+
+            // Jobs of earlier systems can still access chunks, so layout change waits for all of them
+            int current = 0;
+            Manager->SetStructuralChangeCallback([&]()
+            {
+                // Job waiting here could be waiting for itself, so this is fatal in every build
+                if (GetWorkerIndex() != -1)
+                {
+                    printf("Entity layout changed from job while world was updating\n");
+                    std::terminate();
+                }
+
+                for (int j = 0; j < current; ++j)
+                    Worker->Complete(SystemHandles[j]);
+                for (auto& handle : UpdateList[current].System->RecordedAccess.ScheduledJobs)
+                    Worker->Complete(handle);
+            });
+
+            for (; current < UpdateList.size(); ++current)
+            {
+                int i = current;
+                auto system = UpdateList[i].System;
+
+                Dependencies.clear();
+                for (int j = 0; j < i; ++j)
+                {
+                    // Same system can be in list several times, its updates never overlap
+                    auto other = UpdateList[j].System;
+                    if (other == system || system->Access.Conflicts(other->Access))
+                        Dependencies.push_back(SystemHandles[j]);
+                }
+
+                system->RecordedAccess.ScheduledJobs.clear();
+                system->RecordedAccess.Dependencies = Dependencies;
+                system->DeltaTime = UpdateList[i].DeltaTime;
+                system->OnUpdate();
+                SystemHandles[i] = Worker->Combine(system->RecordedAccess.ScheduledJobs);
+                system->RecordedAccess.Dependencies.clear();
+                system->Access.Add(system->RecordedAccess);
+            }
+
+            Manager->SetStructuralChangeCallback(nullptr);
+
+            for (auto& handle : SystemHandles)
+                Worker->Complete(handle);
+
+            for (auto system : Systems)
+                system->Access.Add(system->RecordedAccess);
+        }
+
     private:
         EntityManager* Manager;
         BlobManager* m_BlobManager;
         WorkerManager* Worker;
 
-        std::vector<System*> Systems;
+        std::vector<System*> Systems; // In creation order
+        std::unordered_map<std::type_index, System*> SystemsByType;
+        SystemGroup* Root;
+
+        std::vector<UpdateEntry> UpdateList;
+        std::chrono::steady_clock::time_point LastUpdateTime;
+        std::vector<JobHandle> SystemHandles;
+        std::vector<JobHandle> Dependencies;
     };
+
+    template<class G>
+    void System::UpdateInGroup()
+    {
+        static_assert(std::is_base_of<SystemGroup, G>::value, "Group must derive from SystemGroup");
+        Group = &World->GetOrCreateSystem<G>();
+    }
 }
\ No newline at end of file
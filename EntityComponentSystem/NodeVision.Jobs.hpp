@@ -2,7 +2,24 @@
 
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <thread>
 #include <condition_variable>
+#include <memory>
+#include <array>
+#include <new>
+#include <climits>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <coroutine>
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "NodeVision.Profiling.h"
 
@@ -21,19 +38,69 @@ namespace NodeVision::Jobs
         virtual void Execute() = 0;
     };
 
+    struct IJobParallelFor
+    {
+        virtual void Execute(int index) = 0;
+    };
+
     struct JobHandle
     {
         int Index;
         int Version;
     };
 
+    // Workers always drain higher priority first. Background jobs are limited to subset of workers,
+    // so long running work like asset imports never occupies all of them.
+    enum class JobPriority
+    {
+        High,
+        Normal,
+        Background,
+        Count,
+    };
+
+    typedef void (*JobDestroy)(IJob*);
+
+    struct JobData;
+
+    // Node of intrusive list of jobs waiting on a dependency. Nodes live in the waiting job itself,
+    // as all its dependencies are known at enqueue time or when job suspends.
+    struct JobContinuation
+    {
+        JobData* Job;
+        JobContinuation* Next;
+    };
+
     struct JobData
     {
-        JobHandle Handle;
-        byte Data[2560];
-        std::condition_variable Signal;
-        std::vector<JobHandle> Chain;
-        int DependencyLeft;
+        JobData() :
+            Index(0),
+            Version(1),
+            Job(nullptr),
+            Destroy(nullptr),
+            Payload(nullptr),
+            PayloadClass(-1),
+            Continuations(nullptr),
+            DependencyLeft(0),
+            Pins(0),
+            NextFree(0),
+            Priority(JobPriority::Normal),
+            Execute(false)
+        {}
+
+        int Index;
+        std::atomic<int> Version; // Incremented on completion, handles with older version are completed
+        IJob* Job; // Constructed in memory from JobPayloadPool
+        JobDestroy Destroy;
+        void* Payload; // Block is kept after completion and reused by next job in this slot
+        int PayloadClass;
+        std::atomic<JobContinuation*> Continuations; // Closed with sentinel once job is completed
+        std::vector<JobContinuation> Waits;
+        std::vector<JobHandle> Suspends; // Filled by suspended coroutine, job is relinked on these instead of completing
+        std::atomic<int> DependencyLeft;
+        std::atomic<int> Pins; // Threads linking continuation, slot can not be recycled while pinned
+        std::atomic<int> NextFree;
+        JobPriority Priority;
         bool Execute;
     };
 
@@ -74,343 +141,770 @@ namespace NodeVision::Jobs
         bool flag;
     };
 
-    class JobQueue
+    // Job payloads are placement constructed into size classed blocks, so small jobs take only a cache line
+    // and lambdas with big captures still fit. Blocks are recycled per class, which is cheaper than heap,
+    // as most frames schedule same jobs again. Not thread safe, owner is responsible for locking.
+    class JobPayloadPool
     {
     public:
-        JobQueue()
+        static constexpr int MinClassSize = 64;
+        static constexpr int ClassCount = 8; // 64 bytes up to 8 KB, bigger payloads go directly to heap
+        static constexpr int Alignment = 64;
+
+        ~JobPayloadPool()
         {
+            for (auto& blocks : FreeBlocks)
+            {
+                for (auto block : blocks)
+                    ::operator delete(block, std::align_val_t(Alignment));
+            }
         }
 
-        JobHandle Enqueue(const std::vector<JobHandle>& dependencies)
+        template<class T>
+        void* Allocate(int& payloadClass)
         {
-            profile_function;
-            thread_lock(Protect);
+            static_assert(alignof(T) <= Alignment, "Job alignment is not supported");
 
-            JobData* jobData;
-            if (!FreeJobDataIndices.empty())
+            payloadClass = GetClass(sizeof(T));
+            if (payloadClass == -1)
+                return ::operator new(sizeof(T), std::align_val_t(Alignment));
+
+            auto& blocks = FreeBlocks[payloadClass];
+            if (blocks.empty())
+                return ::operator new(MinClassSize << payloadClass, std::align_val_t(Alignment));
+
+            void* block = blocks.back();
+            blocks.pop_back();
+            return block;
+        }
+
+        void Free(void* block, int payloadClass)
+        {
+            if (payloadClass == -1)
             {
-                jobData = JobDatas[FreeJobDataIndices.front()];
-                jobData->Handle.Version++;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = false;
-                jobData->Chain.clear();
-                FreeJobDataIndices.pop();
+                ::operator delete(block, std::align_val_t(Alignment));
+                return;
             }
-            else
+
+            FreeBlocks[payloadClass].push_back(block);
+        }
+
+        static int GetClass(size_t size)
+        {
+            int payloadClass = 0;
+            while ((size_t)(MinClassSize << payloadClass) < size)
             {
-                jobData = new JobData();
-                jobData->Handle.Index = JobDatas.size();
-                jobData->Handle.Version = 1;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = false;
-                JobDatas.push_back(jobData);
+                payloadClass++;
+                if (payloadClass == ClassCount)
+                    return -1;
             }
+            return payloadClass;
+        }
 
-            //printf("I:%d V:%d Queue Combined\n", jobData->Handle.Index, jobData->Handle.Version);
+    private:
+        std::array<std::vector<void*>, ClassCount> FreeBlocks;
+    };
 
+    inline void CpuRelax()
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        _mm_pause();
+#endif
+    }
+
+    // Dependencies are resolved without locks. Each job has atomic count of dependencies left and lock free
+    // list of continuations, which is closed with sentinel on completion. Whoever drops the count to zero
+    // pushes the job into ready queue. Job datas are stored in pages, so handles can be resolved without locking.
+    class JobQueue
+    {
+    public:
+        JobQueue() : FreeHead(0), PageCount(0)
+        {
+            for (auto& page : Pages)
+                page = nullptr;
+        }
 
-            for (auto&& dependency : dependencies)
+        ~JobQueue()
+        {
+            for (int i = 0; i < PageCount; ++i)
             {
-                JobData* dependencyJobData = JobDatas[dependency.Index];
-                if (dependencyJobData->Handle.Version == dependency.Version)
+                JobData* page = Pages[i].load();
+                for (int j = 0; j < PageSize; ++j)
                 {
-                    dependencyJobData->Chain.push_back(jobData->Handle);
-                    jobData->DependencyLeft++;
-                    //printf("I:%d V:%d Adding dependency I:%d V:%d (%d)\n", jobData->Handle.Index, jobData->Handle.Version,
-                    //    dependencyJobData->Handle.Index, dependencyJobData->Handle.Version, jobData->DependencyLeft);
+                    assert(page[j].Job == nullptr);
+                    if (page[j].Payload != nullptr)
+                        Payloads.Free(page[j].Payload, page[j].PayloadClass);
                 }
+                delete[] page;
             }
+        }
 
-            JobHandle jobHandle = jobData->Handle;
+        JobHandle Enqueue(const std::vector<JobHandle>& dependencies)
+        {
+            return EnqueueJob<IJob>(nullptr, dependencies.data(), dependencies.size());
+        }
 
-            if (jobData->DependencyLeft == 0)
-            {
-                //Jobs.push(jobData);
-                // We can simulate execution on main thread
-                jobData->Handle.Version++;
-                FreeJobDataIndices.push(jobData->Handle.Index);
-            }
+        JobHandle Enqueue(std::initializer_list<JobHandle> dependencies)
+        {
+            return EnqueueJob<IJob>(nullptr, dependencies.begin(), dependencies.size());
+        }
 
-            return jobHandle;
+        template<class T>
+        JobHandle Enqueue(const T& job, JobPriority priority = JobPriority::Normal)
+        {
+            return EnqueueJob(&job, nullptr, 0, priority);
         }
 
-        JobHandle Enqueue(std::initializer_list<JobHandle> dependencies)
+        template<class T>
+        JobHandle Enqueue(const T& job, std::initializer_list<JobHandle> dependencies, JobPriority priority = JobPriority::Normal)
         {
-            profile_function;
-            thread_lock(Protect);
+            return EnqueueJob(&job, dependencies.begin(), dependencies.size(), priority);
+        }
 
-            JobData* jobData;
-            if (!FreeJobDataIndices.empty())
-            {
-                jobData = JobDatas[FreeJobDataIndices.front()];
-                jobData->Handle.Version++;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = false;
-                jobData->Chain.clear();
-                FreeJobDataIndices.pop();
-            }
-            else
-            {
-                jobData = new JobData();
-                jobData->Handle.Index = JobDatas.size();
-                jobData->Handle.Version = 1;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = false;
-                JobDatas.push_back(jobData);
-            }
+        template<class T>
+        JobHandle Enqueue(const T& job, const std::vector<JobHandle>& dependencies, JobPriority priority = JobPriority::Normal)
+        {
+            return EnqueueJob(&job, dependencies.data(), dependencies.size(), priority);
+        }
 
+        bool Dequeue(JobData*& out)
+        {
+            profile_function;
+            thread_lock(QueueProtect);
 
-            for (auto&& dependency : dependencies)
+            for (int i = 0; i < (int)JobPriority::Count; ++i)
             {
-                JobData* dependencyJobData = JobDatas[dependency.Index];
-                if (dependencyJobData->Handle.Version == dependency.Version)
+                auto& jobs = Jobs[i];
+                if (jobs.empty())
+                    continue;
+
+                if (i == (int)JobPriority::Background)
                 {
-                    dependencyJobData->Chain.push_back(jobData->Handle);
-                    jobData->DependencyLeft++;
+                    if (RunningBackground.load() >= BackgroundLimit.load())
+                        return false;
+                    RunningBackground.fetch_add(1);
                 }
+
+                out = jobs.front();
+                jobs.pop();
+                ReadyCounts[i].fetch_sub(1);
+                return true;
             }
 
-            JobHandle jobHandle = jobData->Handle;
+            return false;
+        }
 
-            if (jobData->DependencyLeft == 0)
-            {
-                //Jobs.push(jobData);
-                // We can simulate execution on main thread
-                jobData->Handle.Version++;
-                FreeJobDataIndices.push(jobData->Handle.Index);
-            }
+        // Lock free check used by spinning workers, so they do not contend on the queue mutex
+        bool HasReadyJobs() const
+        {
+            if (ReadyCounts[(int)JobPriority::High].load() != 0 || ReadyCounts[(int)JobPriority::Normal].load() != 0)
+                return true;
+            return ReadyCounts[(int)JobPriority::Background].load() != 0 && RunningBackground.load() < BackgroundLimit.load();
+        }
 
-            return jobHandle;
+        // Maximum number of background jobs executing at the same time
+        void SetBackgroundLimit(int limit)
+        {
+            assert(limit > 0);
+            BackgroundLimit = limit;
         }
 
-        template<class T>
-        JobHandle Enqueue(const T& job)
+        bool IsEmpty()
+        {
+            return Outstanding.load(std::memory_order_acquire) == 0;
+        }
+
+        // Blocks until every enqueued job is completed. Spins a bit before parking on the counter,
+        // as during frame sync the last jobs usually finish within few microseconds.
+        void WaitIdle(int spinCount)
         {
             profile_function;
-            thread_lock(Protect);
 
-            JobData* jobData;
-            if (!FreeJobDataIndices.empty())
+            for (int i = 0; i < spinCount; ++i)
             {
-                jobData = JobDatas[FreeJobDataIndices.front()];
-                jobData->Handle.Version++;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = true;
-                jobData->Chain.clear();
-                memcpy(jobData->Data, &job, sizeof(T));
-                FreeJobDataIndices.pop();
-            }
-            else
-            {
-                jobData = new JobData();
-                jobData->Handle.Index = JobDatas.size();
-                jobData->Handle.Version = 1;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = true;
-                assert(sizeof(T) <= 2560);
-                memcpy(jobData->Data, &job, sizeof(T));
-                JobDatas.push_back(jobData);
+                if (IsEmpty())
+                    return;
+                std::this_thread::yield();
             }
 
-            Jobs.push(jobData);
+            int outstanding;
+            while ((outstanding = Outstanding.load(std::memory_order_acquire)) != 0)
+                Outstanding.wait(outstanding, std::memory_order_acquire);
+        }
+
+        void Complete(const JobHandle& jobHandle)
+        {
+            profile_function;
 
-            return jobData->Handle;
+            JobData* jobData = TryGetJobData(jobHandle.Index);
+            if (jobData == nullptr)
+                return;
+
+            int version;
+            while ((version = jobData->Version.load()) == jobHandle.Version)
+                jobData->Version.wait(version);
         }
 
-        template<class T>
-        JobHandle Enqueue(const T& job, std::initializer_list<JobHandle> dependencies)
+        bool IsCompleted(const JobHandle& jobHandle) const
+        {
+            JobData* jobData = TryGetJobData(jobHandle.Index);
+            return jobData == nullptr || jobData->Version.load() != jobHandle.Version;
+        }
+
+        // Parks executed job on dependencies it requested instead of completing it. Job keeps its version,
+        // so handles to it stay valid, and it is executed again on whichever worker releases it.
+        // Returns how many jobs became ready like SetCompleted.
+        int SetSuspended(JobData* jobData)
         {
             profile_function;
-            thread_lock(Protect);
 
-            JobData* jobData;
-            if (!FreeJobDataIndices.empty())
-            {
-                jobData = JobDatas[FreeJobDataIndices.front()];
-                jobData->Handle.Version++;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = true;
-                jobData->Chain.clear();
-                assert(sizeof(T) <= 2560);
-                memcpy(jobData->Data, &job, sizeof(T));
-                FreeJobDataIndices.pop();
-            }
-            else
+            assert(!jobData->Suspends.empty());
+
+            if (jobData->Priority == JobPriority::Background)
+                RunningBackground.fetch_sub(1);
+
+            bool ready = LinkDependencies(jobData, jobData->Suspends.data(), jobData->Suspends.size());
+            jobData->Suspends.clear();
+
+            if (!ready)
+                return 0;
+
+            PushReady(jobData);
+            return 1;
+        }
+
+        // Returns how many jobs became ready, so caller can wake up that many workers
+        int SetCompleted(JobData* jobData)
+        {
+            profile_function;
+
+            if (jobData->Job != nullptr)
             {
-                jobData = new JobData();
-                jobData->Handle.Index = JobDatas.size();
-                jobData->Handle.Version = 1;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = true;
-                assert(sizeof(T) <= 2560);
-                memcpy(jobData->Data, &job, sizeof(T));
-                JobDatas.push_back(jobData);
+                jobData->Destroy(jobData->Job);
+                jobData->Job = nullptr;
             }
 
-            //printf("I:%d V:%d Queue\n", jobData->Handle.Index, jobData->Handle.Version);
+            int released = 0;
+
+            // Slot is freed for next background job, this worker will pick it up itself
+            if (jobData->Priority == JobPriority::Background)
+                RunningBackground.fetch_sub(1);
 
-            for (auto&& dependency : dependencies)
+            // Closing the list makes every later link attempt treat this dependency as satisfied
+            JobContinuation* continuation = jobData->Continuations.exchange(ClosedContinuations());
+            while (continuation != nullptr)
             {
-                JobData* dependencyJobData = JobDatas[dependency.Index];
-                if (dependencyJobData->Handle.Version == dependency.Version)
-                {
-                    dependencyJobData->Chain.push_back(jobData->Handle);
-                    jobData->DependencyLeft++;
-                    //printf("I:%d V:%d Adding dependency I:%d V:%d (%d)\n", jobData->Handle.Index, jobData->Handle.Version, 
-                    //    dependencyJobData->Handle.Index, dependencyJobData->Handle.Version, jobData->DependencyLeft);
+                // Node belongs to the waiting job, it can be reused as soon as the job is released
+                JobContinuation* next = continuation->Next;
+                JobData* waitingJobData = continuation->Job;
 
+                int dependencyLeft = waitingJobData->DependencyLeft.fetch_sub(1) - 1;
+                assert(dependencyLeft >= 0);
+                if (dependencyLeft == 0)
+                {
+                    PushReady(waitingJobData);
+                    released++;
                 }
+
+                continuation = next;
             }
 
-            if (jobData->DependencyLeft == 0)
-                Jobs.push(jobData);
-           // printf("I:%d V:%d Dependency set  %d\n", jobData->Handle.Index, jobData->Handle.Version, jobData->DependencyLeft);
+            FreeJobData(jobData);
 
-            return jobData->Handle;
+            return released;
+        }
+
+    private:
+        static constexpr int PageSize = 256;
+        static constexpr int MaxPageCount = 4096;
+
+        static JobContinuation* ClosedContinuations()
+        {
+            static JobContinuation closed = { nullptr, nullptr };
+            return &closed;
         }
 
         template<class T>
-        JobHandle Enqueue(const T& job, const std::vector<JobHandle>& dependencies)
+        JobHandle EnqueueJob(const T* job, const JobHandle* dependencies, int dependencyCount, JobPriority priority = JobPriority::Normal)
         {
             profile_function;
-            thread_lock(Protect);
 
-            JobData* jobData;
-            if (!FreeJobDataIndices.empty())
+            JobData* jobData = AllocateJobData(job != nullptr, priority);
+            if constexpr (!std::is_same<T, IJob>::value)
+                ConstructPayload(jobData, *job);
+
+            JobHandle jobHandle;
+            jobHandle.Index = jobData->Index;
+            jobHandle.Version = jobData->Version.load();
+
+            if (LinkDependencies(jobData, dependencies, dependencyCount))
             {
-                jobData = JobDatas[FreeJobDataIndices.front()];
-                jobData->Handle.Version++;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = true;
-                jobData->Chain.clear();
-                assert(sizeof(T) <= 2560);
-                memcpy(jobData->Data, &job, sizeof(T));
-                FreeJobDataIndices.pop();
+                if (jobData->Execute)
+                    PushReady(jobData);
+                else
+                    SetCompleted(jobData); // Combined handle with all dependencies completed
             }
-            else
+
+            return jobHandle;
+        }
+
+        // Returns true if all dependencies are already completed
+        bool LinkDependencies(JobData* jobData, const JobHandle* dependencies, int dependencyCount)
+        {
+            // Extra count keeps job from being released by dependencies while it is still linking
+            jobData->DependencyLeft = dependencyCount + 1;
+            jobData->Waits.resize(dependencyCount);
+
+            int satisfied = 1;
+            for (int i = 0; i < dependencyCount; ++i)
             {
-                jobData = new JobData();
-                jobData->Handle.Index = JobDatas.size();
-                jobData->Handle.Version = 1;
-                jobData->DependencyLeft = 0;
-                jobData->Execute = true;
-                assert(sizeof(T) <= 2560);
-                memcpy(jobData->Data, &job, sizeof(T));
-                JobDatas.push_back(jobData);
+                auto& continuation = jobData->Waits[i];
+                continuation.Job = jobData;
+                if (!LinkContinuation(dependencies[i], &continuation))
+                    satisfied++;
             }
 
-            //printf("I:%d V:%d Queue\n", jobData->Handle.Index, jobData->Handle.Version);
+            return jobData->DependencyLeft.fetch_sub(satisfied) == satisfied;
+        }
+
+        // Returns false if dependency is already completed
+        bool LinkContinuation(const JobHandle& dependency, JobContinuation* continuation)
+        {
+            JobData* jobData = TryGetJobData(dependency.Index);
+            if (jobData == nullptr)
+                return false;
+
+            // Pin must be visible before version is checked, completion does it the other way around
+            jobData->Pins.fetch_add(1);
 
-            for (auto&& dependency : dependencies)
+            bool linked = false;
+            if (jobData->Version.load() == dependency.Version)
             {
-                JobData* dependencyJobData = JobDatas[dependency.Index];
-                if (dependencyJobData->Handle.Version == dependency.Version)
+                JobContinuation* head = jobData->Continuations.load();
+                while (head != ClosedContinuations())
                 {
-                    dependencyJobData->Chain.push_back(jobData->Handle);
-                    jobData->DependencyLeft++;
-                    //printf("I:%d V:%d Adding dependency I:%d V:%d (%d)\n", jobData->Handle.Index, jobData->Handle.Version, 
-                    //    dependencyJobData->Handle.Index, dependencyJobData->Handle.Version, jobData->DependencyLeft);
-
+                    continuation->Next = head;
+                    if (jobData->Continuations.compare_exchange_weak(head, continuation))
+                    {
+                        linked = true;
+                        break;
+                    }
                 }
             }
 
-            if (jobData->DependencyLeft == 0)
-                Jobs.push(jobData);
-            // printf("I:%d V:%d Dependency set  %d\n", jobData->Handle.Index, jobData->Handle.Version, jobData->DependencyLeft);
+            jobData->Pins.fetch_sub(1);
 
-            return jobData->Handle;
+            return linked;
         }
 
-        bool Dequeue(JobData*& out)
+        JobData* TryGetJobData(int index) const
+        {
+            if (index < 0 || index >= MaxPageCount * PageSize)
+                return nullptr;
+            JobData* page = Pages[index / PageSize].load(std::memory_order_acquire);
+            if (page == nullptr)
+                return nullptr;
+            return &page[index % PageSize];
+        }
+
+        JobData* AllocateJobData(bool execute, JobPriority priority)
+        {
+            JobData* jobData;
+            while ((jobData = PopFree()) == nullptr)
+                AllocatePage();
+
+            jobData->Execute = execute;
+            jobData->Priority = priority;
+            jobData->Continuations = nullptr;
+
+            Outstanding.fetch_add(1, std::memory_order_relaxed);
+
+            return jobData;
+        }
+
+        void AllocatePage()
         {
             profile_function;
             thread_lock(Protect);
 
-            if (Jobs.empty())
-                return false;
-            out = Jobs.front();
-            Jobs.pop();
-            return true;
+            // Other thread might have added page while we were waiting
+            if ((FreeHead.load() & 0xFFFFFFFF) != 0)
+                return;
+
+            assert(PageCount < MaxPageCount);
+            JobData* page = new JobData[PageSize];
+            for (int i = 0; i < PageSize; ++i)
+                page[i].Index = PageCount * PageSize + i;
+            Pages[PageCount].store(page, std::memory_order_release);
+            PageCount++;
+
+            for (int i = PageSize - 1; i >= 0; --i)
+                PushFree(&page[i]);
         }
 
-        bool IsEmpty()
+        template<class T>
+        void ConstructPayload(JobData* jobData, const T& job)
         {
-            std::lock_guard<std::mutex> lock(Protect);
-            return Jobs.empty() && JobDatas.size() == FreeJobDataIndices.size();
+            static_assert(std::is_base_of<IJob, T>::value, "Job must implement IJob");
+
+            // Recycled job data usually already holds payload of the right class, pool only needs lock to allocate or free
+            int payloadClass = JobPayloadPool::GetClass(sizeof(T));
+            if (jobData->Payload == nullptr || jobData->PayloadClass != payloadClass || payloadClass == -1)
+            {
+                thread_lock(Protect);
+
+                if (jobData->Payload != nullptr)
+                    Payloads.Free(jobData->Payload, jobData->PayloadClass);
+
+                jobData->Payload = Payloads.Allocate<T>(jobData->PayloadClass);
+            }
+
+            jobData->Job = new (jobData->Payload) T(job);
+            jobData->Destroy = [](IJob* job) { ((T*)job)->~T(); };
         }
 
-        void Complete(const JobHandle& jobHandle)
+        void FreeJobData(JobData* jobData)
         {
-            profile_function;
+            // Version must be changed before checking pins, linking does it the other way around
+            jobData->Version.fetch_add(1);
+            jobData->Version.notify_all();
 
-            // Early out if it is completed
-            if (JobDatas[jobHandle.Index]->Handle.Version != jobHandle.Version)
-                return;
+            while (jobData->Pins.load() != 0)
+                CpuRelax();
+
+            PushFree(jobData);
 
-            std::unique_lock<std::mutex> lock(Protect);
+            // Last outstanding job wakes up anyone parked in WaitIdle
+            if (Outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                Outstanding.notify_all();
+        }
 
-            JobData* jobData = JobDatas[jobHandle.Index];
+        // Free job datas are kept in lock free stack, head packs version tag into upper 32 bits against ABA
+        void PushFree(JobData* jobData)
+        {
+            uint64_t head = FreeHead.load();
+            while (true)
+            {
+                jobData->NextFree = (int)(head & 0xFFFFFFFF);
+                uint64_t newHead = (((head >> 32) + 1) << 32) | (uint64_t)(jobData->Index + 1);
+                if (FreeHead.compare_exchange_weak(head, newHead))
+                    break;
+            }
+        }
 
-            // We have to check again, as it is possible job finished after last check
-            if (jobData->Handle.Version != jobHandle.Version)
+        JobData* PopFree()
+        {
+            uint64_t head = FreeHead.load();
+            while (true)
+            {
+                int top = (int)(head & 0xFFFFFFFF);
+                if (top == 0)
+                    return nullptr;
+
+                JobData* jobData = TryGetJobData(top - 1);
+                uint64_t newHead = (((head >> 32) + 1) << 32) | (uint64_t)jobData->NextFree.load();
+                if (FreeHead.compare_exchange_weak(head, newHead))
+                    return jobData;
+            }
+        }
+
+        void PushReady(JobData* jobData)
+        {
+            thread_lock(QueueProtect);
+            Jobs[(int)jobData->Priority].push(jobData);
+            ReadyCounts[(int)jobData->Priority].fetch_add(1);
+        }
+
+    private:
+        std::mutex Protect; // Guards page allocation and payload pool
+        std::array<std::atomic<JobData*>, MaxPageCount> Pages;
+        int PageCount;
+        std::atomic<uint64_t> FreeHead;
+        JobPayloadPool Payloads;
+        std::atomic<int> Outstanding = 0;
+
+        std::mutex QueueProtect;
+        std::array<std::queue<JobData*>, (int)JobPriority::Count> Jobs;
+        std::array<std::atomic<int>, (int)JobPriority::Count> ReadyCounts = {};
+        std::atomic<int> RunningBackground = 0;
+        std::atomic<int> BackgroundLimit = INT_MAX;
+    };
+
+    // Lock free stack of parked workers. Waking up a worker is a single pop instead of walking all workers.
+    // Head packs a version tag into the upper 32 bits to avoid ABA when workers are pushed back concurrently.
+    class IdleWorkerStack
+    {
+    public:
+        IdleWorkerStack() : Head(0), Count(0) {}
+
+        void Resize(int count)
+        {
+            Head = 0;
+            Count = count;
+            Events.resize(count, nullptr);
+            Next.reset(new std::atomic<int>[count]);
+            Listed.reset(new std::atomic<bool>[count]);
+            Parked.reset(new std::atomic<bool>[count]);
+            for (int i = 0; i < count; ++i)
+            {
+                Next[i] = 0;
+                Listed[i] = false;
+                Parked[i] = false;
+            }
+        }
+
+        void Register(int index, AutoResetEvent* event)
+        {
+            assert(0 <= index && index < Count);
+            Events[index] = event;
+        }
+
+        void Push(int index)
+        {
+            // Worker can still be listed if it found work after listing itself last time
+            if (Listed[index].exchange(true))
                 return;
 
-            jobData->Signal.wait(lock);
+            uint64_t head = Head.load();
+            while (true)
+            {
+                Next[index] = (int)(head & 0xFFFFFFFF);
+                uint64_t newHead = (((head >> 32) + 1) << 32) | (uint64_t)(index + 1);
+                if (Head.compare_exchange_weak(head, newHead))
+                    break;
+            }
         }
 
-        void SetCompleted(JobData* jobData)
+        // Lists worker and marks it parked, worker must wait on its event afterwards unless Unpark succeeds
+        void Park(int index)
         {
-            profile_function;
-            thread_lock(Protect);
+            Push(index);
+            Parked[index] = true;
+
+            // Wakeup could have popped and skipped us before we were marked parked, so we list again
+            if (!Listed[index])
+                Push(index);
+        }
+
+        // Returns false if worker was already claimed by Wakeup, in that case its event is set and must be consumed
+        bool Unpark(int index)
+        {
+            return Parked[index].exchange(false);
+        }
+
+        // Wakes up to count parked workers and returns how many were woken. Listed workers that found work
+        // before parking are skipped, they list themselves again next time they run out of jobs.
+        int Wakeup(int count)
+        {
+            int woken = 0;
+            while (woken < count)
+            {
+                int index = Pop();
+                if (index == -1)
+                    break;
+
+                Listed[index] = false;
+                if (!Parked[index].exchange(false))
+                    continue;
+
+                Events[index]->Set();
+                woken++;
+            }
+            return woken;
+        }
 
-            //printf("I:%d V:%d Complete\n", jobData->Handle.Index, jobData->Handle.Version);
+        // Number of workers currently parked
+        int GetParkedCount() const
+        {
+            int count = 0;
+            for (int i = 0; i < Count; ++i)
+            {
+                if (Parked[i])
+                    count++;
+            }
+            return count;
+        }
 
-            jobData->Handle.Version++;
+    private:
+        int Pop()
+        {
+            uint64_t head = Head.load();
+            while (true)
+            {
+                int top = (int)(head & 0xFFFFFFFF);
+                if (top == 0)
+                    return -1;
 
-            FreeJobDataIndices.push(jobData->Handle.Index);
+                uint64_t newHead = (((head >> 32) + 1) << 32) | (uint64_t)Next[top - 1].load();
+                if (Head.compare_exchange_weak(head, newHead))
+                    return top - 1;
+            }
+        }
 
+    private:
+        std::atomic<uint64_t> Head;
+        std::vector<AutoResetEvent*> Events;
+        std::unique_ptr<std::atomic<int>[]> Next;
+        std::unique_ptr<std::atomic<bool>[]> Listed;
+        std::unique_ptr<std::atomic<bool>[]> Parked;
+        int Count;
+    };
 
-            for (auto other : jobData->Chain)
+    struct CpuInfo
+    {
+        int Cpu;
+        int Package;
+        int CacheGroup; // Logical cpus sharing same last level cache
+    };
+
+    // Reads logical cpu layout from sysfs. Used for pinning workers, so workers that steal from each other
+    // share caches and do not migrate between NUMA nodes.
+    class CpuTopology
+    {
+    public:
+        bool Read()
+        {
+            Cpus.clear();
+
+#if defined(__linux__)
+            std::vector<int> online;
+            if (!ReadCpuList("/sys/devices/system/cpu/online", online))
+                return false;
+
+            for (auto cpu : online)
             {
-                JobData* chainJobData = JobDatas[other.Index];
-                chainJobData->DependencyLeft--;
+                char path[256];
 
-                //printf("I:%d V:%d Poke I:%d V:%d (%d)\n", jobData->Handle.Index, jobData->Handle.Version, 
-                //    chainJobData->Handle.Index, chainJobData->Handle.Version, chainJobData->DependencyLeft);
+                CpuInfo info;
+                info.Cpu = cpu;
 
-                assert(chainJobData->DependencyLeft >= 0);
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+                if (!ReadInt(path, info.Package))
+                    info.Package = 0;
 
-                if (chainJobData->DependencyLeft == 0)
+                // Cache group is identified by first cpu sharing the last level cache
+                info.CacheGroup = -1;
+                for (int index = 0; index < 8; ++index)
                 {
-                    Jobs.push(chainJobData);
+                    int level;
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+                    if (!ReadInt(path, level))
+                        break;
+                    if (level != 3)
+                        continue;
+
+                    std::vector<int> shared;
+                    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+                    if (ReadCpuList(path, shared) && !shared.empty())
+                        info.CacheGroup = shared[0];
                 }
+                if (info.CacheGroup == -1)
+                    info.CacheGroup = info.Package;
+
+                Cpus.push_back(info);
             }
 
-            jobData->Signal.notify_all();
+            // Neighbouring workers end up on the same cache
+            std::sort(Cpus.begin(), Cpus.end(), [](const CpuInfo& a, const CpuInfo& b)
+                {
+                    if (a.Package != b.Package)
+                        return a.Package < b.Package;
+                    if (a.CacheGroup != b.CacheGroup)
+                        return a.CacheGroup < b.CacheGroup;
+                    return a.Cpu < b.Cpu;
+                });
+
+            return !Cpus.empty();
+#else
+            return false;
+#endif
         }
 
+        const std::vector<CpuInfo>& GetCpus() const { return Cpus; }
+
     private:
-        std::mutex Protect;
-        std::vector<JobData*> JobDatas;
-        std::queue<int> FreeJobDataIndices;
+        static bool ReadInt(const char* path, int& value)
+        {
+            FILE* file = fopen(path, "r");
+            if (file == nullptr)
+                return false;
+            bool result = fscanf(file, "%d", &value) == 1;
+            fclose(file);
+            return result;
+        }
 
-        std::queue<JobData*> Jobs;
+        // Parses list in format "0-3,8,10-11"
+        static bool ReadCpuList(const char* path, std::vector<int>& cpus)
+        {
+            FILE* file = fopen(path, "r");
+            if (file == nullptr)
+                return false;
+
+            char buffer[1024];
+            bool result = fgets(buffer, sizeof(buffer), file) != nullptr;
+            fclose(file);
+            if (!result)
+                return false;
+
+            char* text = buffer;
+            while (*text != 0 && *text != '\n')
+            {
+                char* end;
+                int first = strtol(text, &end, 10);
+                if (end == text)
+                    return false;
+                int last = first;
+                text = end;
+                if (*text == '-')
+                {
+                    last = strtol(text + 1, &end, 10);
+                    text = end;
+                }
+                for (int cpu = first; cpu <= last; ++cpu)
+                    cpus.push_back(cpu);
+                if (*text == ',')
+                    text++;
+            }
+            return true;
+        }
+
+    private:
+        std::vector<CpuInfo> Cpus;
     };
 
+    // Cache group of worker running on current thread, -1 if it is not pinned
+    static thread_local int g_WorkerCacheGroup = -1;
+    static int GetWorkerCacheGroup() { return g_WorkerCacheGroup; }
+
+    // Job executing on current worker thread
+    static thread_local JobData* g_ExecutingJobData = nullptr;
+
+    // Index of worker running on current thread, -1 for threads that are not workers
+    static thread_local int g_WorkerIndex = -1;
+    static int GetWorkerIndex() { return g_WorkerIndex; }
+
     struct WorkerContext
     {
-        WorkerContext() : ProfileManager(nullptr) {}
+        WorkerContext() : ProfileManager(nullptr), SpinCount(1024), YieldCount(16), Cpu(-1), CacheGroup(-1) {}
         ProfileManager* ProfileManager;
+        int SpinCount; // Iterations of busy polling before yielding
+        int YieldCount; // Iterations of yielding before parking on event
+        int Cpu; // Logical cpu worker is pinned to, -1 lets scheduler decide
+        int CacheGroup;
     };
 
     class Worker
     {
     public:
-        Worker(JobQueue& jobQueue) : 
+        Worker(JobQueue& jobQueue, IdleWorkerStack& idleWorkers, int index) :
             JobQueue(jobQueue),
-            IsSleeping(false), 
+            IdleWorkers(idleWorkers),
+            Index(index),
             IsRunning(false), 
-            Thread(nullptr) {}
+            Thread(nullptr) 
+        {
+            IdleWorkers.Register(Index, &Event);
+        }
 
         ~Worker()
         {
@@ -444,17 +938,15 @@ namespace NodeVision::Jobs
             profile_function;
 
             Event.Set();
-            IsSleeping = false;
         }
 
-        bool Idle() const { return IsSleeping; }
-
         ProfileManager* ProfileManager;
 
     private:
         void Run(WorkerContext context)
         {
             SetProfileManager(context.ProfileManager);
+            SetupThread(context);
 
             profile_function;
             JobData* jobData;
@@ -463,39 +955,303 @@ namespace NodeVision::Jobs
             {
                 if (!JobQueue.Dequeue(jobData))
                 {
-                    Sleep();
+                    if (!Spin(context))
+                        Sleep();
                     continue;
                 }
 
                 if (jobData->Execute)
                 {
-                    IJob& job = *(IJob*)jobData->Data;
-                    job.Execute();
+                    g_ExecutingJobData = jobData;
+                    jobData->Job->Execute();
+                    g_ExecutingJobData = nullptr;
                 }
 
-                JobQueue.SetCompleted(jobData);
+                // This worker picks up one of released jobs itself, rest goes to parked workers
+                int released = jobData->Suspends.empty() ? JobQueue.SetCompleted(jobData) : JobQueue.SetSuspended(jobData);
+                if (released > 1)
+                    IdleWorkers.Wakeup(released - 1);
+            }
+        }
+
+        // Short frames usually queue next job within microseconds, so polling for a while
+        // is much cheaper than paying the full wakeup latency of parked thread
+        bool Spin(const WorkerContext& context)
+        {
+            profile_function;
+
+            for (int i = 0; i < context.SpinCount && IsRunning; ++i)
+            {
+                if (JobQueue.HasReadyJobs())
+                    return true;
+                CpuRelax();
+            }
+
+            for (int i = 0; i < context.YieldCount && IsRunning; ++i)
+            {
+                if (JobQueue.HasReadyJobs())
+                    return true;
+                std::this_thread::yield();
+            }
+
+            return false;
+        }
+
+        void SetupThread(const WorkerContext& context)
+        {
+#if defined(__linux__)
+            // Name is limited to 15 characters
+            char name[16];
+            snprintf(name, sizeof(name), "Worker %d", Index);
+            pthread_setname_np(pthread_self(), name);
+
+            if (context.Cpu != -1)
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(context.Cpu, &cpus);
+                pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
             }
+#endif
+            g_WorkerCacheGroup = context.Cpu != -1 ? context.CacheGroup : -1;
+            g_WorkerIndex = Index;
         }
 
         void Sleep()
         {
             profile_function;
-            IsSleeping = true;
+
+            IdleWorkers.Park(Index);
+
+            // Job could have been queued before we got parked, in that case nobody will wake us up.
+            // If unparking fails, some thread already claimed us and set our event.
+            if (JobQueue.HasReadyJobs() && IdleWorkers.Unpark(Index))
+                return;
+
             Event.WaitOne();
         }
 
     private:
         JobQueue& JobQueue;
+        IdleWorkerStack& IdleWorkers;
         AutoResetEvent Event;
-        bool IsSleeping;
-        bool IsRunning;
+        int Index;
+        std::atomic<bool> IsRunning;
         std::thread* Thread;
     };
 
+    // Shared state of single ParallelFor. Batches are split evenly between slice jobs and each slice packs
+    // its remaining range as begin | end << 32. Slice that runs out of batches steals half of other slice range.
+    template<class T>
+    struct ParallelForState
+    {
+        ParallelForState(const T& job, int length, int batchSize, int sliceCount) :
+            Job(job),
+            Length(length),
+            BatchSize(batchSize),
+            SliceCount(sliceCount),
+            SlicesLeft(sliceCount),
+            Ranges(new std::atomic<uint64_t>[sliceCount]),
+            CacheGroups(new std::atomic<int>[sliceCount])
+        {
+            int batchCount = (length + batchSize - 1) / batchSize;
+            for (int i = 0; i < sliceCount; ++i)
+            {
+                uint64_t begin = (uint64_t)batchCount * i / sliceCount;
+                uint64_t end = (uint64_t)batchCount * (i + 1) / sliceCount;
+                Ranges[i] = begin | (end << 32);
+                CacheGroups[i] = -1;
+            }
+        }
+
+        bool TakeBatch(int slice, int& batch)
+        {
+            auto& range = Ranges[slice];
+            uint64_t value = range.load();
+            while (true)
+            {
+                uint64_t begin = value & 0xFFFFFFFF;
+                uint64_t end = value >> 32;
+                if (begin >= end)
+                    return false;
+
+                if (range.compare_exchange_weak(value, (begin + 1) | (end << 32)))
+                {
+                    batch = (int)begin;
+                    return true;
+                }
+            }
+        }
+
+        // Steals from slices running on the same cache group first, as their data is likely already in shared cache
+        bool Steal(int slice)
+        {
+            int cacheGroup = CacheGroups[slice];
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (int i = 1; i < SliceCount; ++i)
+                {
+                    int victim = (slice + i) % SliceCount;
+                    bool near = cacheGroup != -1 && CacheGroups[victim] == cacheGroup;
+                    if ((pass == 0) != near)
+                        continue;
+
+                    if (Steal(slice, victim))
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        bool Steal(int slice, int victim)
+        {
+            auto& range = Ranges[victim];
+            uint64_t value = range.load();
+            while (true)
+            {
+                uint64_t begin = value & 0xFFFFFFFF;
+                uint64_t end = value >> 32;
+                if (begin >= end)
+                    return false;
+
+                uint64_t middle = end - (end - begin + 1) / 2;
+                if (range.compare_exchange_weak(value, begin | (middle << 32)))
+                {
+                    // Own range is empty, so nobody else can succeed on it with stale value
+                    Ranges[slice] = middle | (end << 32);
+                    return true;
+                }
+            }
+        }
+
+        T Job;
+        int Length;
+        int BatchSize;
+        int SliceCount;
+        std::atomic<int> SlicesLeft;
+        std::unique_ptr<std::atomic<uint64_t>[]> Ranges;
+        std::unique_ptr<std::atomic<int>[]> CacheGroups; // Cache group of worker executing the slice
+    };
+
+    template<class T>
+    struct ParallelForSliceJob : IJob
+    {
+        ParallelForSliceJob(ParallelForState<T>* state, int slice) : State(state), Slice(slice) {}
+
+        virtual void Execute()
+        {
+            profile_function;
+
+            State->CacheGroups[Slice] = GetWorkerCacheGroup();
+
+            int batch;
+            do
+            {
+                while (State->TakeBatch(Slice, batch))
+                {
+                    int begin = batch * State->BatchSize;
+                    int end = std::min(begin + State->BatchSize, State->Length);
+                    for (int i = begin; i < end; ++i)
+                        State->Job.Execute(i);
+                }
+            } while (State->Steal(Slice));
+
+            // Last slice owns the state
+            if (State->SlicesLeft.fetch_sub(1) == 1)
+                delete State;
+        }
+
+        ParallelForState<T>* State;
+        int Slice;
+    };
+
+    // Job written as coroutine, that can co_await job handles without blocking worker. While suspended the job
+    // is linked on awaited handles like on regular dependencies and is resumed by worker that releases it.
+    //
+    // JobCoroutine Import(...)
+    // {
+    //     co_await workerManager.Schedule(LoadJob(...));
+    //     co_await workerManager.Combine(decodeHandle, uploadHandle);
+    // }
+    class JobCoroutine
+    {
+    public:
+        struct Awaiter
+        {
+            bool await_ready() const { return Dependencies.empty(); }
+
+            // Dependencies are only recorded here, as linking them before worker leaves coroutine
+            // would let other worker resume it while it is still running
+            void await_suspend(std::coroutine_handle<>) const
+            {
+                assert(g_ExecutingJobData != nullptr && "JobCoroutine can only be resumed by worker");
+                auto& suspends = g_ExecutingJobData->Suspends;
+                suspends.insert(suspends.end(), Dependencies.begin(), Dependencies.end());
+            }
+
+            void await_resume() const {}
+
+            std::vector<JobHandle> Dependencies;
+        };
+
+        struct promise_type
+        {
+            JobCoroutine get_return_object() { return JobCoroutine(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+
+            Awaiter await_transform(const JobHandle& dependency) { return Awaiter{ { dependency } }; }
+            Awaiter await_transform(const std::vector<JobHandle>& dependencies) { return Awaiter{ dependencies }; }
+        };
+
+        JobCoroutine(JobCoroutine&& other) : Handle(other.Handle) { other.Handle = nullptr; }
+        JobCoroutine(const JobCoroutine&) = delete;
+        JobCoroutine& operator=(const JobCoroutine&) = delete;
+
+        ~JobCoroutine()
+        {
+            if (Handle)
+                Handle.destroy();
+        }
+
+        // Ownership of coroutine frame goes to the job
+        std::coroutine_handle<promise_type> Release()
+        {
+            auto handle = Handle;
+            Handle = nullptr;
+            return handle;
+        }
+
+    private:
+        explicit JobCoroutine(std::coroutine_handle<promise_type> handle) : Handle(handle) {}
+
+    private:
+        std::coroutine_handle<promise_type> Handle;
+    };
+
+    // Copied into job payload, frame is destroyed once coroutine runs to the end
+    struct JobCoroutineJob : IJob
+    {
+        JobCoroutineJob(std::coroutine_handle<JobCoroutine::promise_type> handle) : Handle(handle) {}
+
+        virtual void Execute()
+        {
+            profile_function;
+
+            Handle.resume();
+            if (Handle.done())
+                Handle.destroy();
+        }
+
+        std::coroutine_handle<JobCoroutine::promise_type> Handle;
+    };
+
     class WorkerManager
     {
     public:
-        WorkerManager() : IsRunning(false)
+        WorkerManager() : IsRunning(false), BackgroundWorkerLimit(0)
         {}
 
         ~WorkerManager()
@@ -510,7 +1266,7 @@ namespace NodeVision::Jobs
         JobHandle Schedule(const Job& job)
         {
             auto jobHandle = JobQueue.Enqueue(job);
-            WakeupWorker();
+            WakeupWorkers(1);
             return jobHandle;
         }
 
@@ -518,7 +1274,7 @@ namespace NodeVision::Jobs
         JobHandle Schedule(const Job& job, JobHandles... dependencies)
         {
             auto jobHandle = JobQueue.Enqueue(job, { dependencies... });
-            WakeupWorker();
+            WakeupWorkers(1);
             return jobHandle;
         }
 
@@ -526,27 +1282,100 @@ namespace NodeVision::Jobs
         JobHandle Schedule(const Job& job, const std::vector<JobHandle>& dependencies)
         {
             auto jobHandle = JobQueue.Enqueue(job, dependencies);
-            WakeupWorker();
+            WakeupWorkers(1);
             return jobHandle;
         }
 
+        // Returned handle completes when coroutine returns, not when it first suspends
+        template<typename... JobHandles>
+        JobHandle Schedule(JobCoroutine&& coroutine, JobHandles... dependencies)
+        {
+            return Schedule(JobCoroutineJob(coroutine.Release()), dependencies...);
+        }
+
+        template<typename... JobHandles>
+        JobHandle ScheduleWithPriority(JobPriority priority, JobCoroutine&& coroutine, JobHandles... dependencies)
+        {
+            return ScheduleWithPriority(priority, JobCoroutineJob(coroutine.Release()), dependencies...);
+        }
+
+        template<class Job, typename... JobHandles>
+        JobHandle ScheduleWithPriority(JobPriority priority, const Job& job, JobHandles... dependencies)
+        {
+            auto jobHandle = JobQueue.Enqueue(job, { dependencies... }, priority);
+            WakeupWorkers(1);
+            return jobHandle;
+        }
+
+        template<class Job>
+        JobHandle ScheduleWithPriority(JobPriority priority, const Job& job, const std::vector<JobHandle>& dependencies)
+        {
+            auto jobHandle = JobQueue.Enqueue(job, dependencies, priority);
+            WakeupWorkers(1);
+            return jobHandle;
+        }
+
+        // Executes job for every index in [0, length) across workers. If batchSize is not positive, it is picked
+        // so that every worker gets several batches, which leaves enough room for stealing to balance uneven work.
+        template<class Job, typename... JobHandles>
+        JobHandle ScheduleParallelFor(const Job& job, int length, int batchSize, JobHandles... dependencies)
+        {
+            return ScheduleParallelFor(job, length, batchSize, std::vector<JobHandle>({ dependencies... }));
+        }
+
+        template<class Job>
+        JobHandle ScheduleParallelFor(const Job& job, int length, int batchSize, const std::vector<JobHandle>& dependencies)
+        {
+            profile_function;
+
+            static_assert(std::is_base_of<IJobParallelFor, Job>::value, "Job must implement IJobParallelFor");
+            assert(length >= 0);
+
+            if (length == 0)
+                return Combine(dependencies);
+
+            int workerCount = std::max(GetWorkerCount(), 1);
+            if (batchSize <= 0)
+                batchSize = std::max(length / (workerCount * ParallelForBatchesPerWorker), 1);
+
+            int batchCount = (length + batchSize - 1) / batchSize;
+            int sliceCount = std::min(workerCount, batchCount);
+
+            auto state = new ParallelForState<Job>(job, length, batchSize, sliceCount);
+
+            std::vector<JobHandle> slices;
+            slices.reserve(sliceCount);
+            for (int i = 0; i < sliceCount; ++i)
+            {
+                slices.push_back(JobQueue.Enqueue(ParallelForSliceJob<Job>(state, i), dependencies));
+            }
+            WakeupWorkers(sliceCount);
+
+            return Combine(slices);
+        }
+
         void Complete(const JobHandle& jobHandle)
         {
             JobQueue.Complete(jobHandle);
         }
 
+        bool IsCompleted(const JobHandle& jobHandle) const
+        {
+            return JobQueue.IsCompleted(jobHandle);
+        }
+
         template<typename... JobHandles>
         JobHandle Combine(JobHandles... dependencies)
         {
             auto jobHandle = JobQueue.Enqueue({ dependencies... });
-            WakeupWorker();
+            WakeupWorkers(1);
             return jobHandle;
         }
 
         JobHandle Combine(const std::vector<JobHandle> dependencies)
         {
             auto jobHandle = JobQueue.Enqueue(dependencies);
-            WakeupWorker();
+            WakeupWorkers(1);
             return jobHandle;
         }
 
@@ -555,33 +1384,64 @@ namespace NodeVision::Jobs
             profile_function;
 
             assert(!IsRunning);
+            assert(Workers.size() + workerCount <= MaxWorkerCount);
             IsRunning = true;
+            IdleWorkers.Resize(Workers.size() + workerCount);
             for (int i = 0; i < workerCount; ++i)
             {
-                auto worker = new Worker(JobQueue);
+                auto worker = new Worker(JobQueue, IdleWorkers, Workers.size());
                 worker->Start(WorkerContext());
                 Workers.push_back(worker);
             }
+            UpdateBackgroundLimit();
+        }
+
+        // Pins workers to cpus in topology order, so neighbouring workers share last level cache
+        void Start(int workerCount, const CpuTopology& topology)
+        {
+            auto& cpus = topology.GetCpus();
+            if (cpus.empty())
+            {
+                Start(workerCount);
+                return;
+            }
+
+            std::vector<WorkerContext> contexts(workerCount);
+            for (int i = 0; i < workerCount; ++i)
+            {
+                auto& cpu = cpus[i % cpus.size()];
+                contexts[i].Cpu = cpu.Cpu;
+                contexts[i].CacheGroup = cpu.CacheGroup;
+            }
+            Start(contexts);
         }
 
         void Start(std::initializer_list<WorkerContext> contexts)
+        {
+            Start(std::vector<WorkerContext>(contexts));
+        }
+
+        void Start(const std::vector<WorkerContext>& contexts)
         {
             profile_function;
 
             assert(!IsRunning);
+            assert(Workers.size() + contexts.size() <= MaxWorkerCount);
             IsRunning = true;
+            IdleWorkers.Resize(Workers.size() + contexts.size());
             for (auto context : contexts)
             {
-                auto worker = new Worker(JobQueue);
+                auto worker = new Worker(JobQueue, IdleWorkers, Workers.size());
                 worker->Start(context);
                 Workers.push_back(worker);
             }
+            UpdateBackgroundLimit();
         }
 
-        void Wait()
+        void Wait(int spinCount = DefaultWaitSpinCount)
         {
             profile_function;
-            while (!JobQueue.IsEmpty());
+            JobQueue.WaitIdle(spinCount);
         }
 
         void Stop()
@@ -591,7 +1451,7 @@ namespace NodeVision::Jobs
             assert(IsRunning);
             IsRunning = false;
 
-            while (!JobQueue.IsEmpty());
+            JobQueue.WaitIdle(DefaultWaitSpinCount);
 
             for (auto worker : Workers)
             {
@@ -601,24 +1461,39 @@ namespace NodeVision::Jobs
 
         int GetWorkerCount() const { return Workers.size(); }
 
-    private:
-        void WakeupWorker()
+        // Wakes up to count parked workers, useful after scheduling a batch of jobs
+        int WakeupWorkers(int count)
         {
             profile_function;
+            return IdleWorkers.Wakeup(count);
+        }
 
-            for (auto worker : Workers)
-            {
-                if (worker->Idle())
-                {
-                    worker->Wakeup();
-                    break;
-                }
-            }
+        int GetParkedWorkerCount() const { return IdleWorkers.GetParkedCount(); }
+
+        // Maximum number of workers executing background jobs at the same time.
+        // By default all workers except one, so there is always worker left for frame work.
+        void SetBackgroundWorkerLimit(int limit)
+        {
+            BackgroundWorkerLimit = limit;
+            UpdateBackgroundLimit();
+        }
+
+        static constexpr int DefaultWaitSpinCount = 256;
+        static constexpr int ParallelForBatchesPerWorker = 8;
+        static constexpr int MaxWorkerCount = 64; // Per thread containers are sized by it
+
+    private:
+        void UpdateBackgroundLimit()
+        {
+            int limit = BackgroundWorkerLimit > 0 ? BackgroundWorkerLimit : std::max((int)Workers.size() - 1, 1);
+            JobQueue.SetBackgroundLimit(limit);
         }
 
     private:
         JobQueue JobQueue;
+        IdleWorkerStack IdleWorkers;
         bool IsRunning;
+        int BackgroundWorkerLimit;
         std::vector<Worker*> Workers;
     };
 }
\ No newline at end of file
@@ -7,7 +7,18 @@
 #include "string"
 #include "assert.h"
 #include <charconv>
+#include <stack>
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "NodeVision.Collections.hpp"
+#include "NodeVision.Compression.hpp"
 
 #define transfer(v) stream.Transfer(#v, v);
 #define transfername(n, v) stream.Transfer(n, v);
@@ -35,12 +46,17 @@ namespace NodeVision::Serialization
 
         bool operator<(const Guid& other) const
         {
-            return Value[0] < other.Value[0];
+            for (int i = 0; i < 4; ++i)
+            {
+                if (Value[i] != other.Value[i])
+                    return (unsigned int)Value[i] < (unsigned int)other.Value[i];
+            }
+            return false;
         }
 
         bool operator>(const Guid& other) const
         {
-            return Value[0] > other.Value[0];
+            return other < *this;
         }
 
         bool operator==(const Guid& other) const
@@ -50,14 +66,27 @@ namespace NodeVision::Serialization
 
         bool Valid() const { return Value[0] != 0 && Value[1] != 0 && Value[2] != 0 && Value[3] != 0; }
 
+        // Mixes all words, so guids that differ only in one word still spread over all buckets
+        size_t GetHash() const
+        {
+            unsigned long long value;
+            unsigned long long value2;
+            memcpy(&value, Value, sizeof(value));
+            memcpy(&value2, Value + 2, sizeof(value2));
+
+            unsigned long long hash = value ^ (value2 * 0x9e3779b97f4a7c15ull);
+            hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+            hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+            return hash ^ (hash >> 31);
+        }
+
     public:
         int Value[4];
     };
 
-    class ISerializable;
-
     struct TypeTree
     {
+        // New types are added at the end, binary snapshots store them as numbers
         enum class Type
         {
             Undefined,
@@ -66,71 +95,240 @@ namespace NodeVision::Serialization
             Integer,
             Float,
             Boolean,
+            Int8,
+            UInt8,
+            Int16,
+            UInt16,
+            UInt32,
+            Int64,
+            UInt64,
+            Double,
         };
 
         struct Field
         {
-            Field(const char* name, Type type) : Name(name), Type(type) {}
-            Field() : Name(""), Type(Type::Undefined) {}
+            Field(const char* name, Type type) : Name(name), Type(type), Offset(0), Size(0), Length(1) {}
+            Field() : Name(""), Type(Type::Undefined), Offset(0), Size(0), Length(1) {}
+
+            // Same data that can be at other offset
+            bool Matches(const Field& other) const
+            {
+                return Name == other.Name && Type == other.Type && Size == other.Size && Length == other.Length &&
+                    Fields == other.Fields;
+            }
+
+            bool operator==(const Field& other) const { return Offset == other.Offset && Matches(other); }
 
             FixedString256 Name;
             Type Type;
+            int Offset; // From start of parent
+            int Size; // Whole field, for array all elements
+            int Length; // Elements of array
+            std::vector<Field> Fields; // Members of structure or single element of array
         };
 
+        template<class T>
+        static constexpr Type GetType()
+        {
+            if constexpr (std::is_same_v<T, bool>)
+                return Type::Boolean;
+            else if constexpr (std::is_floating_point_v<T>)
+                return sizeof(T) == 4 ? Type::Float : Type::Double;
+            else if constexpr (sizeof(T) == 1)
+                return std::is_signed_v<T> ? Type::Int8 : Type::UInt8;
+            else if constexpr (sizeof(T) == 2)
+                return std::is_signed_v<T> ? Type::Int16 : Type::UInt16;
+            else if constexpr (sizeof(T) == 4)
+                return std::is_signed_v<T> ? Type::Integer : Type::UInt32;
+            else
+                return std::is_signed_v<T> ? Type::Int64 : Type::UInt64;
+        }
+
+        static const char* GetName(Type type)
+        {
+            static const char* names[] = { "Undefined", "Structure", "Array", "Integer", "Float", "Boolean", "Int8",
+                "UInt8", "Int16", "UInt16", "UInt32", "Int64", "UInt64", "Double" };
+            return names[(int)type];
+        }
+
+        static Type GetType(const char* name)
+        {
+            for (int i = 0; i <= (int)Type::Double; ++i)
+            {
+                if (strcmp(GetName((Type)i), name) == 0)
+                    return (Type)i;
+            }
+            return Type::Undefined;
+        }
+
+        static bool IsScalar(Type type) { return type != Type::Undefined && type != Type::Structure && type != Type::Array; }
+
+        // Trees saved before fields had offsets contain only 4 byte scalars placed one after other
+        static void LayoutLegacy(std::vector<Field>& fields)
+        {
+            int offset = 0;
+            for (auto& field : fields)
+            {
+                field.Offset = offset;
+                field.Size = 4;
+                field.Length = 1;
+                offset += field.Size;
+            }
+        }
+
+        // Layout of data, name of type is not compared
+        bool operator==(const TypeTree& other) const { return Size == other.Size && Fields == other.Fields; }
+        bool operator!=(const TypeTree& other) const { return !(operator==(other)); }
+
         FixedString256 Name;
         std::vector<Field> Fields;
         int Size;
     };
 
+    // Builds type tree from Transfer of default constructed value, offsets are taken from addresses of members
     class TypeTreeStream
     {
     public:
-        TypeTreeStream(TypeTree& typeTree) : TypeTree(typeTree)
+        TypeTreeStream(TypeTree& typeTree, const void* base) : Fields(typeTree.Fields), Base((const byte*)base)
+        {
+        }
+
+        TypeTreeStream(std::vector<TypeTree::Field>& fields, const void* base) : Fields(fields), Base((const byte*)base)
         {
         }
 
         bool IsRead() { return false; }
 
-        void Transfer(const char* name, float& value)
+        template<class T> requires std::is_arithmetic_v<T>
+        void Transfer(const char* name, T& value)
         {
-            TypeTree.Fields.push_back(TypeTree::Field(name, TypeTree::Type::Float));
+            Add(name, TypeTree::GetType<T>(), &value, sizeof(T));
         }
-        void Transfer(const char* name, int& value)
+
+        template<class T, int N>
+        void Transfer(const char* name, T (&value)[N])
         {
-            TypeTree.Fields.push_back(TypeTree::Field(name, TypeTree::Type::Integer));
+            auto& field = Add(name, TypeTree::Type::Array, value, sizeof(value));
+            field.Length = N;
+
+            TypeTreeStream element(field.Fields, value);
+            element.Transfer("Element", value[0]);
         }
-        void Transfer(const char* name, bool& value)
+
+        template<class T>
+        void Transfer(const char* name, T* value, int length)
         {
-            TypeTree.Fields.push_back(TypeTree::Field(name, TypeTree::Type::Boolean));
+            auto& field = Add(name, TypeTree::Type::Array, value, sizeof(T) * length);
+            field.Length = length;
+
+            TypeTreeStream element(field.Fields, value);
+            element.Transfer("Element", value[0]);
+        }
+
+        template<class T>
+        void Transfer(const char* name, T& value)
+        {
+            auto& field = Add(name, TypeTree::Type::Structure, &value, sizeof(T));
+
+            TypeTreeStream member(field.Fields, &value);
+            value.Transfer(member);
         }
-        void Transfer(const char* name, ISerializable& value)
+
+    private:
+        TypeTree::Field& Add(const char* name, TypeTree::Type type, const void* value, int size)
         {
-            TypeTree.Fields.push_back(TypeTree::Field(name, TypeTree::Type::Structure));
+            TypeTree::Field field(name, type);
+            field.Offset = (const byte*)value - Base;
+            field.Size = size;
+            Fields.push_back(field);
+            return Fields.back();
         }
-        void Transfer(const char* name, int* value, int length)
+
+        std::vector<TypeTree::Field>& Fields;
+        const byte* Base;
+    };
+
+    // Converts data saved with older type tree into current one. Top level fields are matched by name and layout,
+    // fields that do not exist in saved data get value of default constructed type.
+    struct TypeMigration
+    {
+        // Bytes copied from saved to current layout, adjacent fields are merged
+        struct Copy
+        {
+            int Source;
+            int Target;
+            int Size;
+        };
+
+        TypeMigration() {}
+        TypeMigration(const TypeTree& source, const TypeTree& target, const std::vector<byte>& defaults) :
+            Source(source),
+            Defaults(defaults)
         {
-            TypeTree.Fields.push_back(TypeTree::Field(name, TypeTree::Type::Array));
+            assert(Defaults.size() == target.Size);
+
+            for (auto& targetField : target.Fields)
+            {
+                for (auto& sourceField : source.Fields)
+                {
+                    if (!sourceField.Matches(targetField))
+                        continue;
+
+                    if (!Copies.empty() &&
+                        Copies.back().Source + Copies.back().Size == sourceField.Offset &&
+                        Copies.back().Target + Copies.back().Size == targetField.Offset)
+                    {
+                        Copies.back().Size += targetField.Size;
+                    }
+                    else
+                    {
+                        Copies.push_back({ sourceField.Offset, targetField.Offset, targetField.Size });
+                    }
+                    break;
+                }
+            }
         }
-        void Transfer(const char* name, ISerializable* value, int stride, int length)
+
+        void Apply(const byte* source, byte* target, int length) const
         {
-            TypeTree.Fields.push_back(TypeTree::Field(name, TypeTree::Type::Array));
+            int sourceSize = Source.Size;
+            int targetSize = Defaults.size();
+            for (int i = 0; i < length; ++i)
+            {
+                memcpy(target, Defaults.data(), targetSize);
+                for (auto& copy : Copies)
+                    memcpy(target + copy.Target, source + copy.Source, copy.Size);
+
+                source += sourceSize;
+                target += targetSize;
+            }
         }
 
-        TypeTree& TypeTree;
+        TypeTree Source;
+        std::vector<byte> Defaults;
+        std::vector<Copy> Copies;
     };
 
+    // Formats into memory buffer and writes it to file in big blocks. Floats are written with shortest text that
+    // reads back to same value.
     class YamlWriteStream2
     {
     public:
+        YamlWriteStream2() : file(0), bufferLength(0), indent(0), isArray(false) {}
+
         bool Open(const char* path)
         {
             file = fopen(path, "w");
+            buffer.resize(BlockSize);
+            bufferLength = 0;
             indent = 0;
+            isArray = false;
             return file != 0;
         }
 
         bool Close()
         {
+            Flush();
             return fclose(file) == 0;
         }
 
@@ -139,15 +337,17 @@ namespace NodeVision::Serialization
         void Transfer(const char* name, float& value)
         {
             Indent();
-            auto valueToString = std::to_string(value);
-            fprintf(file, "%s: %s\n", name, valueToString.c_str());
+            WriteKey(name);
+            WriteValue(value);
+            Write("\n", 1);
         }
 
         void Transfer(const char* name, int& value)
         {
             Indent();
-            auto valueToString = std::to_string(value);
-            fprintf(file, "%s: %s\n", name, valueToString.c_str());
+            WriteKey(name);
+            WriteValue(value);
+            Write("\n", 1);
         }
 
         void Transfer(const char* name, bool& value)
@@ -159,65 +359,31 @@ namespace NodeVision::Serialization
         void Transfer(const char* name, FixedString256& value)
         {
             Indent();
-            fprintf(file, "%s: %s\n", name, value.Data);
+            WriteKey(name);
+            Write(value.Data, strlen(value.Data));
+            Write("\n", 1);
         }
 
         void Transfer(const char* name, Guid& value)
         {
             Indent();
-            auto valueToString0 = std::to_string(value.Value[0]);
-            auto valueToString1 = std::to_string(value.Value[1]);
-            auto valueToString2 = std::to_string(value.Value[2]);
-            auto valueToString3 = std::to_string(value.Value[3]);
-            fprintf(file, "%s: %s %s %s %s\n", name, valueToString0.c_str(), valueToString1.c_str(), valueToString2.c_str(), valueToString3.c_str());
+            WriteKey(name);
+            for (int i = 0; i < 4; ++i)
+            {
+                if (i != 0)
+                    Write(" ", 1);
+                WriteValue(value.Value[i]);
+            }
+            Write("\n", 1);
         }
 
         void Transfer(const char* name, TypeTree& typeTree)
         {
-            Indent();
-
-            auto& fields = typeTree.Fields;
-
-            auto valueToString = std::to_string(fields.size());
-
-            fprintf(file, "%s: \# %s\n", name, valueToString.c_str());
-            indent++;
-            for (int i = 0; i < fields.size(); ++i)
-            {
-                isArray = true;
-
-                switch (fields[i].Type)
-                {
-                case TypeTree::Type::Integer:
-                    Transfer("Name", fields[i].Name);
-                    Indent();
-                    fprintf(file, "Type: Integer\n");
-                    break;
-                case TypeTree::Type::Float:
-                    Transfer("Name", fields[i].Name);
-                    Indent();
-                    fprintf(file, "Type: Float\n");
-                    break;
-                case TypeTree::Type::Boolean:
-                    Transfer("Name", fields[i].Name);
-                    Indent();
-                    fprintf(file, "Type: Boolean\n");
-                    break;
-                default:
-                    assert(false);
-                    break;
-                }
-            }
-            indent--;
+            WriteTypeFields(name, typeTree.Fields);
         }
 
         void Transfer(const TypeTree& typeTree, byte* data, int length)
         {
-            Indent();
-
-            auto& fields = typeTree.Fields;
-            auto ptr = (char*)data;
-
             const char* name = "NoName";
             const char* shortName = strchr(typeTree.Name.Data, ' ');
             if (shortName != 0)
@@ -226,53 +392,33 @@ namespace NodeVision::Serialization
             if (shortName != 0)
                 name = shortName + 1;
 
-            fprintf(file, "%s:\n", name);
+            Indent();
+            Write(name, strlen(name));
+            Write(":\n", 2);
             indent++;
             for (int j = 0; j < length; ++j)
             {
                 isArray = true;
-                byte* fieldPtr = ptr;
-                for (int i = 0; i < fields.size(); ++i)
-                {
-                    switch (fields[i].Type)
-                    {
-                    case TypeTree::Type::Integer:
-                        Transfer(fields[i].Name.Data, *((int*)fieldPtr));
-                        fieldPtr += sizeof(int);
-                        break;
-                    case TypeTree::Type::Float:
-                        Transfer(fields[i].Name.Data, *((float*)fieldPtr));
-                        fieldPtr += sizeof(float);
-                        break;
-                    case TypeTree::Type::Boolean:
-                        Transfer(fields[i].Name.Data, *((int*)fieldPtr));
-                        fieldPtr += sizeof(int);
-                        break;
-                    default:
-                        assert(false);
-                        break;
-                    }
-                }
-                ptr += typeTree.Size;
+                WriteFields(typeTree.Fields, data + j * typeTree.Size);
             }
             indent--;
         }
 
         void Transfer(const char* name, std::stack<int>& value)
         {
-            Indent();
-
-            int* ptr = value.empty() ? nullptr : &value.top();
+            // Written from bottom, so reading pushes values back in same order
+            std::vector<int> values;
+            for (std::stack<int> copy = value; !copy.empty(); copy.pop())
+                values.push_back(copy.top());
 
-            auto valueToString = std::to_string(value.size());
-
-            fprintf(file, "%s: \# %s\n", name, valueToString.c_str());
+            WriteCount(name, values.size());
             indent++;
-            for (int i = 0; i < value.size(); ++i)
+            for (int i = values.size() - 1; i >= 0; --i)
             {
-                valueToString = std::to_string(ptr[i]);
                 Indent();
-                fprintf(file, "- %s\n", valueToString.c_str());
+                Write("- ", 2);
+                WriteValue(values[i]);
+                Write("\n", 1);
             }
             indent--;
         }
@@ -280,24 +426,20 @@ namespace NodeVision::Serialization
         void Transfer(const char* name, std::vector<int>& value)
         {
             Indent();
-
-            fprintf(file, "%s: [", name);
+            WriteKey(name);
+            Write("[", 1);
             for (int i = 0; i < value.size(); ++i)
             {
-                auto valueToString = std::to_string(value[i]);
-                fprintf(file, "%s, ", valueToString.c_str());
+                WriteValue(value[i]);
+                Write(", ", 2);
             }
-            fprintf(file, "]\n");
+            Write("]\n", 2);
         }
 
         template<class T>
         void Transfer(const char* name, std::vector<T>& value)
         {
-            Indent();
-
-            auto valueToString = std::to_string(value.size());
-
-            fprintf(file, "%s: \# %s\n", name, valueToString.c_str());
+            WriteCount(name, value.size());
             indent++;
             for (int i = 0; i < value.size(); ++i)
             {
@@ -311,39 +453,197 @@ namespace NodeVision::Serialization
         void Transfer(const char* name, T& value)
         {
             Indent();
-            fprintf(file, "%s:\n", name);
+            Write(name, strlen(name));
+            Write(":\n", 2);
             indent++;
             value.Transfer(*this);
             indent--;
         }
 
     private:
+        static const int BlockSize = 1 << 16;
+
         void Indent()
         {
             for (int i = 0; i < indent; ++i)
             {
                 if (isArray && i == indent - 1)
                 {
-                    fwrite("- ", 2, 1, file);
+                    Write("- ", 2);
                     isArray = false;
                 }
                 else
-                    fwrite("  ", 2, 1, file);
+                    Write("  ", 2);
             }
         }
 
+        void WriteKey(const char* name)
+        {
+            Write(name, strlen(name));
+            Write(": ", 2);
+        }
+
+        void WriteLine(const char* text)
+        {
+            Indent();
+            Write(text, strlen(text));
+        }
+
+        void WriteCount(const char* name, int count)
+        {
+            Indent();
+            WriteKey(name);
+            Write("# ", 2);
+            WriteValue(count);
+            Write("\n", 1);
+        }
+
+        void WriteTypeFields(const char* name, std::vector<TypeTree::Field>& fields)
+        {
+            WriteCount(name, fields.size());
+            indent++;
+            for (auto& field : fields)
+            {
+                isArray = true;
+                Transfer("Name", field.Name);
+                Indent();
+                WriteKey("Type");
+                Write(TypeTree::GetName(field.Type), strlen(TypeTree::GetName(field.Type)));
+                Write("\n", 1);
+                Transfer("Offset", field.Offset);
+                Transfer("Size", field.Size);
+                if (field.Type == TypeTree::Type::Array)
+                    Transfer("Length", field.Length);
+                if (!TypeTree::IsScalar(field.Type))
+                    WriteTypeFields("Fields", field.Fields);
+            }
+            indent--;
+        }
+
+        // Scalar arrays are written in one line, other arrays as list of elements
+        void WriteFields(const std::vector<TypeTree::Field>& fields, const byte* data)
+        {
+            for (auto& field : fields)
+            {
+                const byte* ptr = data + field.Offset;
+                if (field.Type == TypeTree::Type::Structure)
+                {
+                    Indent();
+                    Write(field.Name.Data, strlen(field.Name.Data));
+                    Write(":\n", 2);
+                    indent++;
+                    WriteFields(field.Fields, ptr);
+                    indent--;
+                }
+                else if (field.Type == TypeTree::Type::Array)
+                {
+                    auto& element = field.Fields[0];
+                    if (TypeTree::IsScalar(element.Type))
+                    {
+                        Indent();
+                        WriteKey(field.Name.Data);
+                        Write("[", 1);
+                        for (int i = 0; i < field.Length; ++i)
+                        {
+                            WriteScalar(element.Type, ptr + i * element.Size);
+                            Write(", ", 2);
+                        }
+                        Write("]\n", 2);
+                    }
+                    else
+                    {
+                        WriteCount(field.Name.Data, field.Length);
+                        indent++;
+                        for (int i = 0; i < field.Length; ++i)
+                        {
+                            isArray = true;
+                            WriteFields(element.Type == TypeTree::Type::Structure ? element.Fields : field.Fields, ptr + i * element.Size);
+                        }
+                        indent--;
+                    }
+                }
+                else
+                {
+                    Indent();
+                    WriteKey(field.Name.Data);
+                    WriteScalar(field.Type, ptr);
+                    Write("\n", 1);
+                }
+            }
+        }
+
+        void WriteScalar(TypeTree::Type type, const byte* ptr)
+        {
+            switch (type)
+            {
+            case TypeTree::Type::Integer: WriteValue(*(const int*)ptr); break;
+            case TypeTree::Type::Float: WriteValue(*(const float*)ptr); break;
+            case TypeTree::Type::Boolean: WriteValue((int)*(const bool*)ptr); break;
+            case TypeTree::Type::Int8: WriteValue(*(const signed char*)ptr); break;
+            case TypeTree::Type::UInt8: WriteValue(*(const unsigned char*)ptr); break;
+            case TypeTree::Type::Int16: WriteValue(*(const short*)ptr); break;
+            case TypeTree::Type::UInt16: WriteValue(*(const unsigned short*)ptr); break;
+            case TypeTree::Type::UInt32: WriteValue(*(const unsigned int*)ptr); break;
+            case TypeTree::Type::Int64: WriteValue(*(const long long*)ptr); break;
+            case TypeTree::Type::UInt64: WriteValue(*(const unsigned long long*)ptr); break;
+            case TypeTree::Type::Double: WriteValue(*(const double*)ptr); break;
+            default:
+                assert(false);
+                break;
+            }
+        }
+
+        template<class T>
+        void WriteValue(T value)
+        {
+            char text[32];
+            auto result = std::to_chars(text, text + sizeof(text), value);
+            Write(text, result.ptr - text);
+        }
+
+        void Write(const char* data, size_t size)
+        {
+            if (bufferLength + size > buffer.size())
+            {
+                Flush();
+                if (size > buffer.size())
+                {
+                    fwrite(data, 1, size, file);
+                    return;
+                }
+            }
+            memcpy(buffer.data() + bufferLength, data, size);
+            bufferLength += size;
+        }
+
+        void Flush()
+        {
+            if (bufferLength != 0)
+                fwrite(buffer.data(), 1, bufferLength, file);
+            bufferLength = 0;
+        }
+
     private:
         FILE* file;
+        std::vector<char> buffer;
+        size_t bufferLength;
         int indent;
         bool isArray;
     };
 
+    // Reads file in big blocks and splits it into lines in single forward pass. Lines can be of any length.
     class YamlReadStream2
     {
     public:
+        YamlReadStream2() : file(0), begin(0), end(0), scan(0) {}
+
         bool Open(const char* path)
         {
-            auto result = fopen_s(&file, path, "r");
+            auto result = fopen_s(&file, path, "rb");
+            buffer.resize(BlockSize);
+            begin = 0;
+            end = 0;
+            scan = 0;
             return result == 0;
         }
 
@@ -356,22 +656,14 @@ namespace NodeVision::Serialization
 
         void Transfer(const char* name, float& value)
         {
-            char buffer[256];
-            fgets(buffer, 256, file);
-
-            const char* valueTextStart = strchr(buffer, ':') + 2;
-            const char* valueTextEnd = strchr(buffer, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, value);
+            auto text = ReadValue();
+            std::from_chars(text.Start, text.End, value);
         }
 
         void Transfer(const char* name, int& value)
         {
-            char buffer[256];
-            fgets(buffer, 256, file);
-
-            const char* valueTextStart = strchr(buffer, ':') + 2;
-            const char* valueTextEnd = strchr(buffer, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, value);
+            auto text = ReadValue();
+            std::from_chars(text.Start, text.End, value);
         }
 
         void Transfer(const char* name, bool& value)
@@ -383,194 +675,922 @@ namespace NodeVision::Serialization
 
         void Transfer(const char* name, FixedString256& value)
         {
-            char buffer[256];
-            fgets(buffer, 256, file);
-
-            const char* valueTextStart = strchr(buffer, ':') + 2;
-            const char* valueTextEnd = strchr(buffer, '\n');
+            auto text = ReadValue();
 
-            memcpy(value.Data, valueTextStart, valueTextEnd - valueTextStart);
-            value.Data[valueTextEnd - valueTextStart] = 0;
+            int length = std::min(text.Length(), (int)sizeof(value.Data) - 1);
+            memcpy(value.Data, text.Start, length);
+            value.Data[length] = 0;
         }
 
         void Transfer(const char* name, Guid& value)
         {
-            char buffer[256];
-            fgets(buffer, 256, file);
+            auto text = ReadValue();
 
-            const char* valueTextStart = strchr(buffer, ':') + 2;
-            const char* valueTextEnd = strchr(valueTextStart, ' ');
-            std::from_chars(valueTextStart, valueTextEnd, value.Value[0]);
+            const char* start = text.Start;
+            for (int i = 0; i < 4; ++i)
+            {
+                start = SkipSpaces(start, text.End);
+                start = std::from_chars(start, text.End, value.Value[i]).ptr;
+            }
+        }
 
-            valueTextStart = valueTextEnd + 1;
-            valueTextEnd = strchr(valueTextStart, ' ');
-            std::from_chars(valueTextStart, valueTextEnd, value.Value[1]);
+        void Transfer(const char* name, TypeTree& typeTree)
+        {
+            ReadTypeFields(typeTree.Fields);
+        }
 
-            valueTextStart = valueTextEnd + 1;
-            valueTextEnd = strchr(valueTextStart, ' ');
-            std::from_chars(valueTextStart, valueTextEnd, value.Value[2]);
+        void Transfer(const TypeTree& typeTree, byte* data, int length)
+        {
+            // skip name
+            ReadLine();
 
-            valueTextStart = valueTextEnd + 1;
-            valueTextEnd = strchr(valueTextStart, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, value.Value[3]);
+            for (int j = 0; j < length; ++j)
+                ReadFields(typeTree.Fields, data + j * typeTree.Size);
         }
 
-        void Transfer(const char* name, TypeTree& typeTree)
+        void Transfer(const char* name, std::stack<int>& value)
         {
-            char buffer[256];
+            int size = ReadCount();
 
-            int size;
-            fgets(buffer, 256, file);
-            char* valueTextStart = strchr(buffer, '#') + 2;
-            char* valueTextEnd = strchr(buffer, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, size);
+            for (int i = 0; i < size; ++i)
+            {
+                auto line = ReadLine();
 
-            auto& fields = typeTree.Fields;
+                const char* start = (const char*)memchr(line.Start, '-', line.Length());
+                assert(start != nullptr);
+                start = SkipSpaces(start + 1, line.End);
 
-            fields.resize(size);
+                int v;
+                std::from_chars(start, (const char*)line.End, v);
+                value.push(v);
+            }
+        }
 
-            for (int i = 0; i < fields.size(); ++i)
+        void Transfer(const char* name, std::vector<int>& value)
+        {
+            auto text = ReadValue();
+
+            value.clear();
+
+            const char* start = (const char*)memchr(text.Start, '[', text.Length());
+            assert(start != nullptr);
+            start++;
+            while (true)
             {
-                Transfer("Name", fields[i].Name);
+                while (start != text.End && (*start == ' ' || *start == ','))
+                    start++;
+                if (start == text.End || *start == ']')
+                    break;
 
-                FixedString256 type;
-                Transfer("Type", type);
+                int v;
+                start = std::from_chars(start, (const char*)text.End, v).ptr;
+                value.push_back(v);
+            }
+        }
 
-                if (type == "Integer")
-                {
-                    fields[i].Type = TypeTree::Type::Integer;
-                }
+        template<class T>
+        void Transfer(const char* name, std::vector<T>& value)
+        {
+            int size = ReadCount();
+
+            value.resize(size);
+
+            for (int i = 0; i < value.size(); ++i)
+            {
+                value[i].Transfer(*this);
+            }
+        }
+
+        template<class T>
+        void Transfer(const char* name, T& value)
+        {
+            // skip name
+            ReadLine();
+
+            value.Transfer(*this);
+        }
+
+    private:
+        static const int BlockSize = 1 << 16;
 
-                if (type == "Float")
+        static const char* SkipSpaces(const char* start, const char* end)
+        {
+            while (start != end && *start == ' ')
+                start++;
+            return start;
+        }
+
+        // Line is valid until next read
+        StringSlice ReadLine()
+        {
+            while (true)
+            {
+                char* newLine = (char*)memchr(buffer.data() + scan, '\n', end - scan);
+                if (newLine != nullptr)
                 {
-                    fields[i].Type = TypeTree::Type::Float;
+                    StringSlice line(buffer.data() + begin, newLine);
+                    begin = newLine - buffer.data() + 1;
+                    scan = begin;
+                    if (line.End != line.Start && line.End[-1] == '\r')
+                        line.End--;
+                    return line;
                 }
 
-                if (type == "Boolean")
+                scan = end;
+                if (!Fill())
                 {
-                    fields[i].Type = TypeTree::Type::Boolean;
+                    // Last line without line break
+                    StringSlice line(buffer.data() + begin, buffer.data() + end);
+                    begin = end;
+                    return line;
                 }
             }
         }
 
-        void Transfer(const TypeTree& typeTree, byte* data, int length)
+        // Moves unread part to the front and reads next block after it, grows buffer if line does not fit
+        bool Fill()
+        {
+            size_t remaining = end - begin;
+            memmove(buffer.data(), buffer.data() + begin, remaining);
+            scan -= begin;
+            begin = 0;
+            end = remaining;
+
+            if (end == buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            size_t read = fread(buffer.data() + end, 1, buffer.size() - end, file);
+            end += read;
+            return read != 0;
+        }
+
+        // Text after "name:"
+        StringSlice ReadValue()
         {
-            char buffer[256];
-            fgets(buffer, 256, file);
+            auto line = ReadLine();
 
-            auto& fields = typeTree.Fields;
-            byte* ptr = (byte*)data;
+            char* start = (char*)memchr(line.Start, ':', line.Length());
+            if (start == nullptr)
+                return StringSlice(line.End, line.End);
 
-            for (int j = 0; j < length; ++j)
+            return StringSlice((char*)SkipSpaces(start + 1, line.End), line.End);
+        }
+
+        // Checks key of next line without reading it
+        bool IsNextKey(const char* key)
+        {
+            auto line = ReadLine();
+            begin = line.Start - buffer.data();
+            scan = begin;
+
+            const char* start = line.Start;
+            while (start != line.End && (*start == ' ' || *start == '-'))
+                start++;
+            size_t length = strlen(key);
+            return line.End - start > length && memcmp(start, key, length) == 0 && start[length] == ':';
+        }
+
+        void ReadTypeFields(std::vector<TypeTree::Field>& fields)
+        {
+            fields.resize(ReadCount());
+
+            bool legacy = false;
+            for (auto& field : fields)
             {
-                for (int i = 0; i < fields.size(); ++i)
+                Transfer("Name", field.Name);
+
+                FixedString256 type;
+                Transfer("Type", type);
+                field.Type = TypeTree::GetType(type.Data);
+
+                if (!IsNextKey("Offset"))
                 {
-                    switch (fields[i].Type)
+                    legacy = true;
+                    continue;
+                }
+
+                Transfer("Offset", field.Offset);
+                Transfer("Size", field.Size);
+                if (field.Type == TypeTree::Type::Array)
+                    Transfer("Length", field.Length);
+                if (!TypeTree::IsScalar(field.Type))
+                    ReadTypeFields(field.Fields);
+            }
+
+            if (legacy)
+                TypeTree::LayoutLegacy(fields);
+        }
+
+        void ReadFields(const std::vector<TypeTree::Field>& fields, byte* data)
+        {
+            for (auto& field : fields)
+            {
+                byte* ptr = data + field.Offset;
+                if (field.Type == TypeTree::Type::Structure)
+                {
+                    ReadLine();
+                    ReadFields(field.Fields, ptr);
+                }
+                else if (field.Type == TypeTree::Type::Array)
+                {
+                    auto& element = field.Fields[0];
+                    if (TypeTree::IsScalar(element.Type))
+                    {
+                        auto text = ReadValue();
+
+                        const char* start = (const char*)memchr(text.Start, '[', text.Length());
+                        assert(start != nullptr);
+                        start++;
+                        for (int i = 0; i < field.Length; ++i)
+                        {
+                            while (start != text.End && (*start == ' ' || *start == ','))
+                                start++;
+                            start = ReadScalar(element.Type, start, text.End, ptr + i * element.Size);
+                        }
+                    }
+                    else
                     {
-                    case TypeTree::Type::Integer:
-                        Transfer("", *(int*)ptr);
-                        ptr += sizeof(int);
-                        break;
-                    case TypeTree::Type::Float:
-                        Transfer("", *(float*)ptr);
-                        ptr += sizeof(float);
-                        break;
-                    case TypeTree::Type::Boolean:
-                        Transfer("", *(int*)ptr);
-                        ptr += sizeof(int);
-                        break;
-                    default:
-                        assert(false);
-                        break;
+                        int length = ReadCount();
+                        assert(length == field.Length);
+                        for (int i = 0; i < length; ++i)
+                            ReadFields(element.Type == TypeTree::Type::Structure ? element.Fields : field.Fields, ptr + i * element.Size);
                     }
                 }
-                //ptr += typeTree.Size;
+                else
+                {
+                    auto text = ReadValue();
+                    ReadScalar(field.Type, text.Start, text.End, ptr);
+                }
             }
         }
 
-        void Transfer(const char* name, std::stack<int>& value)
+        const char* ReadScalar(TypeTree::Type type, const char* start, const char* end, byte* ptr)
         {
-            //char buffer[256];
-            //fgets(buffer, 256, file);
+            switch (type)
+            {
+            case TypeTree::Type::Integer: return ParseValue<int>(start, end, ptr);
+            case TypeTree::Type::Float: return ParseValue<float>(start, end, ptr);
+            case TypeTree::Type::Int8: return ParseValue<signed char>(start, end, ptr);
+            case TypeTree::Type::UInt8: return ParseValue<unsigned char>(start, end, ptr);
+            case TypeTree::Type::Int16: return ParseValue<short>(start, end, ptr);
+            case TypeTree::Type::UInt16: return ParseValue<unsigned short>(start, end, ptr);
+            case TypeTree::Type::UInt32: return ParseValue<unsigned int>(start, end, ptr);
+            case TypeTree::Type::Int64: return ParseValue<long long>(start, end, ptr);
+            case TypeTree::Type::UInt64: return ParseValue<unsigned long long>(start, end, ptr);
+            case TypeTree::Type::Double: return ParseValue<double>(start, end, ptr);
+            case TypeTree::Type::Boolean:
+            {
+                int value = 0;
+                start = std::from_chars(start, end, value).ptr;
+                *(bool*)ptr = value != 0;
+                return start;
+            }
+            default:
+                assert(false);
+                return end;
+            }
+        }
 
-            char buffer[256];
-            fgets(buffer, 256, file);
+        template<class T>
+        static const char* ParseValue(const char* start, const char* end, byte* ptr)
+        {
+            T value = 0;
+            auto result = std::from_chars(start, end, value);
+            memcpy(ptr, &value, sizeof(T));
+            return result.ptr;
+        }
 
-            int size;
-            const char* valueTextStart = strchr(buffer, '#') + 2;
-            const char* valueTextEnd = strchr(buffer, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, size);
+        // Count written as "name: # count"
+        int ReadCount()
+        {
+            auto line = ReadLine();
 
-            valueTextStart = valueTextEnd;
-            for (int i = 0; i < size; ++i)
+            int count = 0;
+            const char* start = (const char*)memchr(line.Start, '#', line.Length());
+            if (start != nullptr)
             {
-                fgets(buffer, 256, file);
+                start = SkipSpaces(start + 1, line.End);
+                std::from_chars(start, (const char*)line.End, count);
+            }
+            return count;
+        }
 
-                valueTextStart = strchr(buffer, '-') + 2;
-                valueTextEnd = strchr(valueTextStart, '\n');
-                int v;
-                std::from_chars(valueTextStart, valueTextEnd, v);
-                value.push(v);
+    private:
+        FILE* file;
+        std::vector<char> buffer;
+        size_t begin; // Start of unread data
+        size_t end; // End of data read from file
+        size_t scan; // Position to continue search for line break from
+    };
+
+    // Whole file mapped into memory. Pages are private, so writes copy the page and never reach the file.
+    // Without mmap support the file is read into memory.
+    class MappedFile
+    {
+    public:
+        MappedFile() : Data(nullptr), Size(0), Mapped(false) {}
+        MappedFile(const MappedFile&) = delete;
+
+        ~MappedFile()
+        {
+#if defined(__linux__)
+            if (Mapped)
+            {
+                munmap(Data, Size);
+                return;
             }
-            fprintf(file, "]\n");
+#endif
+            delete[] Data;
         }
 
-        void Transfer(const char* name, std::vector<int>& value)
+        bool Open(const char* path, bool prefetch)
         {
-            char buffer[256];
-            fgets(buffer, 256, file);
+#if defined(__linux__)
+            int fd = open(path, O_RDONLY);
+            if (fd == -1)
+                return false;
 
-            int size;
-            const char* valueTextStart = strchr(buffer, '#') + 2;
-            const char* valueTextEnd = strchr(buffer, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, size);
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size == 0)
+            {
+                close(fd);
+                return false;
+            }
 
-            value.resize(size);
+            void* data = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (data == MAP_FAILED)
+                return false;
+
+            if (prefetch)
+                madvise(data, info.st_size, MADV_WILLNEED);
+
+            Data = (byte*)data;
+            Size = info.st_size;
+            Mapped = true;
+            return true;
+#else
+            FILE* file = fopen(path, "rb");
+            if (file == 0)
+                return false;
+
+            fseek(file, 0, SEEK_END);
+            Size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+
+            Data = new byte[Size];
+            bool result = fread(Data, 1, Size, file) == Size;
+            fclose(file);
+            return result;
+#endif
+        }
 
-            valueTextStart = strchr(buffer, '[') + 2;
-            for (int i = 0; i < value.size(); ++i)
-            {
-                valueTextEnd = strchr(valueTextStart, ' ');
-                if (valueTextEnd == nullptr)
+        // Owned memory instead of file
+        void Allocate(size_t size)
+        {
+            assert(Data == nullptr);
+            Data = new byte[size];
+            Size = size;
+        }
+
+        byte* Data;
+        size_t Size;
+
+    private:
+        bool Mapped;
+    };
+
+    // Byte buffer that owns its memory or uses pages of mapped file in place. Resize always moves it to own memory.
+    class PageBuffer
+    {
+    public:
+        PageBuffer() : Mapped(nullptr), MappedSize(0) {}
 
-                std::from_chars(valueTextStart, valueTextEnd, value[0]);
-                valueTextStart = valueTextEnd;
+        byte* data() { return Mapped != nullptr ? Mapped : Owned.data(); }
+        const byte* data() const { return Mapped != nullptr ? Mapped : Owned.data(); }
+        size_t size() const { return Mapped != nullptr ? MappedSize : Owned.size(); }
+
+        void resize(size_t size)
+        {
+            if (Mapped != nullptr)
+            {
+                Owned.assign(Mapped, Mapped + std::min(size, MappedSize));
+                Mapped = nullptr;
+                MappedSize = 0;
+                Mapping.reset();
             }
-            fprintf(file, "]\n");
+            Owned.resize(size);
+        }
+
+        void Map(const std::shared_ptr<MappedFile>& mapping, byte* data, size_t size)
+        {
+            Owned.clear();
+            Owned.shrink_to_fit();
+            Mapping = mapping;
+            Mapped = data;
+            MappedSize = size;
+        }
+
+        bool IsMapped() const { return Mapped != nullptr; }
+
+    private:
+        std::vector<byte> Owned;
+        std::shared_ptr<MappedFile> Mapping; // Keeps file mapped while buffer uses it
+        byte* Mapped;
+        size_t MappedSize;
+    };
+
+    // Binary snapshot stream. Scalars are written as is, component arrays are written as one length prefixed blob
+    // aligned to BlobAlignment, so whole chunk column is saved and loaded with single fwrite/fread.
+    class BinaryWriteStream
+    {
+    public:
+        static const int Magic = 0x5357564e; // NVWS
+        static const int Version = 4;
+        static const int MinVersion = 2; // Type trees without field offsets
+        static const int BlobAlignment = 64;
+        static const int PageAlignment = 4096;
+
+        enum Flags
+        {
+            None = 0,
+            Compressed = 1 << 0, // Chunk columns are compressed
+        };
+
+        BinaryWriteStream() : file(0), position(0), compressed(false) {}
+
+        bool Open(const char* path, bool compress = false)
+        {
+            file = fopen(path, "wb");
+            if (file == 0)
+                return false;
+
+            setvbuf(file, nullptr, _IOFBF, 1 << 16);
+            position = 0;
+            compressed = compress;
+
+            int magic = Magic;
+            int version = Version;
+            int flags = compressed ? Flags::Compressed : Flags::None;
+            Write(&magic, sizeof(int));
+            Write(&version, sizeof(int));
+            Write(&flags, sizeof(int));
+            return true;
+        }
+
+        // Stream without header that writes into memory, used to encode blocks concurrently
+        void OpenMemory(bool compress = false)
+        {
+            file = 0;
+            memory.clear();
+            position = 0;
+            compressed = compress;
+        }
+
+        bool Close()
+        {
+            if (file == 0)
+                return true;
+            return fclose(file) == 0;
+        }
+
+        const std::vector<byte>& GetMemory() const { return memory; }
+
+        bool IsCompressed() const { return compressed; }
+
+        // Block starts at page boundary, so page alignment inside of block is kept
+        void WriteBlock(const std::vector<byte>& block)
+        {
+            WritePadding(PageAlignment);
+            Write(block.data(), block.size());
+        }
+
+        bool IsRead() { return false; }
+
+        void Transfer(const char* name, float& value) { Write(&value, sizeof(float)); }
+        void Transfer(const char* name, int& value) { Write(&value, sizeof(int)); }
+        void Transfer(const char* name, long long& value) { Write(&value, sizeof(long long)); }
+        void Transfer(const char* name, bool& value) { Write(&value, sizeof(bool)); }
+        void Transfer(const char* name, Guid& value) { Write(value.Value, sizeof(value.Value)); }
+
+        void Transfer(const char* name, FixedString256& value)
+        {
+            int length = strlen(value.Data);
+            Write(&length, sizeof(int));
+            Write(value.Data, length);
+        }
+
+        void Transfer(const char* name, TypeTree& typeTree)
+        {
+            Transfer("Name", typeTree.Name);
+            Transfer("Size", typeTree.Size);
+            TransferFields(typeTree.Fields);
+        }
+
+        void Transfer(const TypeTree& typeTree, byte* data, int length)
+        {
+            long long size = (long long)typeTree.Size * length;
+            Write(&size, sizeof(long long));
+
+            WritePadding(BlobAlignment);
+            Write(data, size);
+        }
+
+        // Column is encoded on its own, so columns and chunks can be decoded in any order
+        void TransferColumn(const char* name, byte* data, int count, int stride)
+        {
+            std::vector<byte> encoded;
+            Compression::EncodeColumn(data, count, stride, encoded);
+
+            int size = encoded.size();
+            Write(&size, sizeof(int));
+            Write(encoded.data(), size);
+        }
+
+        // Buffer starts at page boundary of the file, so mapped read stream can use it in place
+        void TransferPages(const char* name, PageBuffer& buffer)
+        {
+            long long size = buffer.size();
+            Write(&size, sizeof(long long));
+
+            WritePadding(PageAlignment);
+            Write(buffer.data(), size);
+        }
+
+        void Transfer(const char* name, std::stack<int>& value)
+        {
+            std::vector<int> values;
+            for (std::stack<int> copy = value; !copy.empty(); copy.pop())
+                values.push_back(copy.top());
+            std::reverse(values.begin(), values.end());
+            Transfer(name, values);
+        }
+
+        void Transfer(const char* name, std::vector<int>& value)
+        {
+            int count = value.size();
+            Write(&count, sizeof(int));
+            Write(value.data(), count * sizeof(int));
         }
 
         template<class T>
         void Transfer(const char* name, std::vector<T>& value)
         {
-            char buffer[256];
+            int count = value.size();
+            Write(&count, sizeof(int));
+            for (auto& item : value)
+                item.Transfer(*this);
+        }
+
+        template<class T>
+        void Transfer(const char* name, T& value)
+        {
+            value.Transfer(*this);
+        }
+
+        static int GetPadding(long long position, int alignment)
+        {
+            return (alignment - position % alignment) % alignment;
+        }
+
+    private:
+        void TransferFields(std::vector<TypeTree::Field>& fields)
+        {
+            int count = fields.size();
+            Write(&count, sizeof(int));
+            for (auto& field : fields)
+            {
+                Transfer("Name", field.Name);
+                int type = (int)field.Type;
+                Write(&type, sizeof(int));
+                Transfer("Offset", field.Offset);
+                Transfer("Size", field.Size);
+                Transfer("Length", field.Length);
+                TransferFields(field.Fields);
+            }
+        }
+
+        void Write(const void* data, long long size)
+        {
+            if (size == 0)
+                return;
+            if (file != 0)
+                fwrite(data, 1, size, file);
+            else
+                memory.insert(memory.end(), (const byte*)data, (const byte*)data + size);
+            position += size;
+        }
+
+        void WritePadding(int alignment)
+        {
+            static const char padding[PageAlignment] = {};
+            Write(padding, GetPadding(position, alignment));
+        }
+
+    private:
+        FILE* file;
+        std::vector<byte> memory;
+        long long position;
+        bool compressed;
+    };
+
+    // Reads from file or from mapped file. Mapped stream does not copy page buffers, they keep using file pages.
+    class BinaryReadStream
+    {
+    public:
+        BinaryReadStream() :
+            file(0),
+            memory(nullptr),
+            memorySize(0),
+            mapPages(false),
+            position(0),
+            version(BinaryWriteStream::Version),
+            compressed(false)
+        {
+        }
+
+        bool Open(const char* path)
+        {
+            file = fopen(path, "rb");
+            if (file == 0)
+                return false;
+
+            setvbuf(file, nullptr, _IOFBF, 1 << 16);
+            position = 0;
+
+            if (!ReadHeader())
+            {
+                fclose(file);
+                file = 0;
+                return false;
+            }
+            return true;
+        }
+
+        // With prefetch whole file is requested from disk in advance, otherwise pages are loaded on first access
+        bool OpenMapped(const char* path, bool prefetch = true)
+        {
+            mapping = std::make_shared<MappedFile>();
+            position = 0;
+
+            if (!mapping->Open(path, prefetch))
+            {
+                mapping.reset();
+                return false;
+            }
+
+            memory = mapping->Data;
+            memorySize = mapping->Size;
+            mapPages = true;
+
+            if (!ReadHeader())
+            {
+                Close();
+                return false;
+            }
+            return true;
+        }
+
+        bool Close()
+        {
+            if (memory != nullptr)
+            {
+                mapping.reset();
+                memory = nullptr;
+                return true;
+            }
+            return fclose(file) == 0;
+        }
+
+        // Stream over next block written by BinaryWriteStream::WriteBlock, blocks can be read concurrently.
+        // Block of mapped stream uses mapped memory, otherwise it is read into memory first.
+        BinaryReadStream ReadBlock(long long size)
+        {
+            Skip(BinaryWriteStream::GetPadding(position, BinaryWriteStream::PageAlignment));
+
+            BinaryReadStream block;
+            if (memory != nullptr)
+            {
+                assert(position + size <= memorySize);
+                block.mapping = mapping;
+                block.memory = memory + position;
+                block.mapPages = mapPages;
+                position += size;
+            }
+            else
+            {
+                block.mapping = std::make_shared<MappedFile>();
+                block.mapping->Allocate(size);
+                block.memory = block.mapping->Data;
+                Read(block.memory, size);
+            }
+            block.memorySize = size;
+            block.version = version;
+            block.compressed = compressed;
+            return block;
+        }
+
+        bool IsRead() { return true; }
+
+        bool IsCompressed() const { return compressed; }
+
+        void Transfer(const char* name, float& value) { Read(&value, sizeof(float)); }
+        void Transfer(const char* name, int& value) { Read(&value, sizeof(int)); }
+        void Transfer(const char* name, long long& value) { Read(&value, sizeof(long long)); }
+        void Transfer(const char* name, bool& value) { Read(&value, sizeof(bool)); }
+        void Transfer(const char* name, Guid& value) { Read(value.Value, sizeof(value.Value)); }
+
+        void Transfer(const char* name, FixedString256& value)
+        {
+            int length;
+            Read(&length, sizeof(int));
+            assert(length < sizeof(value.Data));
+            Read(value.Data, length);
+            value.Data[length] = 0;
+        }
+
+        void Transfer(const char* name, TypeTree& typeTree)
+        {
+            Transfer("Name", typeTree.Name);
+            Transfer("Size", typeTree.Size);
+            TransferFields(typeTree.Fields);
+        }
 
+        void Transfer(const TypeTree& typeTree, byte* data, int length)
+        {
+            long long size;
+            Read(&size, sizeof(long long));
+            assert(size == (long long)typeTree.Size * length);
+
+            Skip(BinaryWriteStream::GetPadding(position, BinaryWriteStream::BlobAlignment));
+            Read(data, size);
+        }
+
+        void TransferColumn(const char* name, byte* data, int count, int stride)
+        {
             int size;
-            fgets(buffer, 256, file);
-            const char* valueTextStart = strchr(buffer, '#') + 2;
-            const char* valueTextEnd = strchr(buffer, '\n');
-            std::from_chars(valueTextStart, valueTextEnd, size);
+            Read(&size, sizeof(int));
 
-            value.resize(size);
+            const byte* encoded;
+            std::vector<byte> buffer;
+            if (memory != nullptr)
+            {
+                assert(position + size <= memorySize);
+                encoded = memory + position;
+                position += size;
+            }
+            else
+            {
+                buffer.resize(size);
+                Read(buffer.data(), size);
+                encoded = buffer.data();
+            }
 
-            for (int i = 0; i < value.size(); ++i)
+            bool result = Compression::DecodeColumn(encoded, size, data, count, stride);
+            assert(result && "Column data is corrupted");
+        }
+
+        void TransferPages(const char* name, PageBuffer& buffer)
+        {
+            long long size;
+            Read(&size, sizeof(long long));
+
+            Skip(BinaryWriteStream::GetPadding(position, BinaryWriteStream::PageAlignment));
+            if (mapPages)
             {
-                value[i].Transfer(*this);
+                assert(position + size <= memorySize);
+                buffer.Map(mapping, memory + position, size);
+                position += size;
+            }
+            else
+            {
+                buffer.resize(size);
+                Read(buffer.data(), size);
             }
         }
 
+        void Transfer(const char* name, std::stack<int>& value)
+        {
+            std::vector<int> values;
+            Transfer(name, values);
+            value = std::stack<int>();
+            for (int item : values)
+                value.push(item);
+        }
+
+        void Transfer(const char* name, std::vector<int>& value)
+        {
+            int count;
+            Read(&count, sizeof(int));
+            value.resize(count);
+            Read(value.data(), count * sizeof(int));
+        }
+
+        template<class T>
+        void Transfer(const char* name, std::vector<T>& value)
+        {
+            int count;
+            Read(&count, sizeof(int));
+            value.resize(count);
+            for (auto& item : value)
+                item.Transfer(*this);
+        }
+
         template<class T>
         void Transfer(const char* name, T& value)
         {
-            char buffer[256];
+            value.Transfer(*this);
+        }
 
-            // skip name
-            fgets(buffer, 256, file);
+    private:
+        void TransferFields(std::vector<TypeTree::Field>& fields)
+        {
+            int count;
+            Read(&count, sizeof(int));
+            fields.resize(count);
+            for (auto& field : fields)
+            {
+                Transfer("Name", field.Name);
+                int type;
+                Read(&type, sizeof(int));
+                field.Type = (TypeTree::Type)type;
+                if (version < 3)
+                    continue;
+
+                Transfer("Offset", field.Offset);
+                Transfer("Size", field.Size);
+                Transfer("Length", field.Length);
+                TransferFields(field.Fields);
+            }
 
-            value.Transfer(*this);
+            if (version < 3)
+                TypeTree::LayoutLegacy(fields);
+        }
+
+        bool ReadHeader()
+        {
+            int magic = 0;
+            version = 0;
+            if (!Read(&magic, sizeof(int)) || !Read(&version, sizeof(int)))
+                return false;
+            if (magic != BinaryWriteStream::Magic || version < BinaryWriteStream::MinVersion || version > BinaryWriteStream::Version)
+                return false;
+
+            int flags = BinaryWriteStream::Flags::None;
+            if (version >= 4 && !Read(&flags, sizeof(int)))
+                return false;
+            compressed = (flags & BinaryWriteStream::Flags::Compressed) != 0;
+            return true;
+        }
+
+        bool Read(void* data, long long size)
+        {
+            if (size == 0)
+                return true;
+
+            if (memory != nullptr)
+            {
+                if (position + size > memorySize)
+                {
+                    assert(false);
+                    return false;
+                }
+                memcpy(data, memory + position, size);
+            }
+            else
+            {
+                if (fread(data, 1, size, file) != size)
+                {
+                    assert(false);
+                    return false;
+                }
+            }
+
+            position += size;
+            return true;
+        }
+
+        void Skip(int size)
+        {
+            if (memory != nullptr)
+            {
+                position += size;
+                return;
+            }
+
+            char padding[BinaryWriteStream::PageAlignment];
+            Read(padding, size);
         }
 
     private:
         FILE* file;
+        std::shared_ptr<MappedFile> mapping; // Keeps memory alive
+        byte* memory;
+        long long memorySize;
+        bool mapPages; // Page buffers use memory in place
+        long long position;
+        int version;
+        bool compressed; // Chunk columns are compressed
     };
 
     struct ITest
@@ -585,4 +1605,9 @@ namespace NodeVision::Serialization
     };
 
     struct IDisposable {};
-}
\ No newline at end of file
+}
+template<>
+struct std::hash<NodeVision::Serialization::Guid>
+{
+    size_t operator()(const NodeVision::Serialization::Guid& guid) const { return guid.GetHash(); }
+};
\ No newline at end of file